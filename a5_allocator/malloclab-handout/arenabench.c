@@ -0,0 +1,164 @@
+/*
+ * arenabench - compare arenas with malloc and free per object
+ *
+ * Runs a request-scoped workload: each request allocates a number of
+ * objects, writes to each, and then frees all of them when it ends.
+ * The workload is run three ways:
+ *
+ *   mm       mm_malloc and mm_free for each object
+ *   arena    mm_arena_alloc for each object, and one mm_arena_reset
+ *            at the end of each request
+ *   libc     malloc and free for each object
+ *
+ * Object sizes are uniform in log scale between -m and -M bytes. Each
+ * run is timed as a whole, and for the two mm runs the mappings made
+ * and the largest heap, counting decommitted pages, are printed too.
+ *
+ * usage: arenabench [options]
+ *   -n <n>      number of requests (100000)
+ *   -k <n>      objects allocated by each request (64)
+ *   -m <bytes>  smallest object (16)
+ *   -M <bytes>  largest object (1024)
+ *   -s <seed>   random seed (1)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* Number of object sizes drawn before the runs, used over and over */
+#define NUM_SIZES (1 << 16)
+
+enum {MM, ARENA, LIBC, NUM_RUNS};
+static char *run_names[] = {"mm", "arena", "libc"};
+
+/* Parameters */
+static long num_requests = 100000, num_objects = 64;
+static double min_size = 16, max_size = 1024;
+static uint64_t seed = 1;
+
+static uint32_t sizes[NUM_SIZES];
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: arenabench [-n requests] [-k objects] [-m min] [-M max] [-s seed]\n");
+    exit(1);
+}
+
+/* splitmix64, as in gentrace */
+static uint64_t next_random(void)
+{
+    uint64_t z = (seed += 0x9E3779B97F4A7C15UL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * run - Run the workload one way, and return its time in seconds.
+ *     The largest heap is stored in *peak.
+ */
+static double run(int how, void **objects, size_t *peak)
+{
+    struct mm_arena *arena = NULL;
+    long r, i;
+    size_t s = 0;
+    double start;
+
+    mm_init();
+    if (how == ARENA)
+	arena = mm_arena_create();
+    *peak = 0;
+
+    start = now();
+    for (r = 0; r < num_requests; r++) {
+	for (i = 0; i < num_objects; i++, s++) {
+	    uint32_t size = sizes[s & (NUM_SIZES - 1)];
+	    switch (how) {
+	    case MM:    objects[i] = mm_malloc(size); break;
+	    case ARENA: objects[i] = mm_arena_alloc(arena, size); break;
+	    case LIBC:  objects[i] = malloc(size); break;
+	    }
+	    *(long *)objects[i] = i;
+	}
+	if (mem_reservedsize() > *peak)
+	    *peak = mem_reservedsize();
+	switch (how) {
+	case MM:
+	    for (i = 0; i < num_objects; i++)
+		mm_free(objects[i]);
+	    break;
+	case ARENA:
+	    mm_arena_reset(arena);
+	    break;
+	case LIBC:
+	    for (i = 0; i < num_objects; i++)
+		free(objects[i]);
+	    break;
+	}
+    }
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    int c, how;
+    void **objects;
+    struct mm_stats stats;
+    size_t peak;
+    double secs, objs;
+    long i;
+
+    while ((c = getopt(argc, argv, "n:k:m:M:s:")) != EOF) {
+	switch (c) {
+	case 'n': num_requests = atol(optarg); break;
+	case 'k': num_objects = atol(optarg); break;
+	case 'm': min_size = atof(optarg); break;
+	case 'M': max_size = atof(optarg); break;
+	case 's': seed = strtoull(optarg, NULL, 0); break;
+	default: usage();
+	}
+    }
+    if (optind != argc || num_requests < 1 || num_objects < 1 || min_size < 8 ||
+	max_size < min_size || max_size > INT32_MAX) {
+	fprintf(stderr, "arenabench: bad parameter\n");
+	exit(1);
+    }
+
+    mem_init();
+    for (i = 0; i < NUM_SIZES; i++)
+	sizes[i] = min_size * pow(max_size / min_size, (next_random() >> 11) / 9007199254740992.0);
+    if ((objects = malloc(num_objects * sizeof(void *))) == NULL) {
+	perror("malloc failed in main");
+	exit(1);
+    }
+
+    printf("%ld requests of %ld objects of %.0f to %.0f bytes\n",
+	   num_requests, num_objects, min_size, max_size);
+    printf("%6s%10s%12s%8s%10s\n", "run", "ns/obj", "ns/request", "maps", "peak KB");
+    objs = (double)num_requests * num_objects;
+    for (how = 0; how < NUM_RUNS; how++) {
+	secs = run(how, objects, &peak);
+	printf("%6s%10.1f%12.0f", run_names[how], secs * 1e9 / objs, secs * 1e9 / num_requests);
+	if (how == LIBC) {
+	    printf("%8s%10s\n", "-", "-");
+	    continue;
+	}
+	mm_stats(&stats);
+	printf("%8zu%10zu\n", stats.maps, peak / 1024);
+	mem_reset();
+    }
+    return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * gentrace - generate large synthetic traces
+ *
+ * Each block gets a size from a power-law (bounded Pareto) distribution
+ * and one of these lifetimes, picked by the weights given with -t:
+ *
+ *   short   freed after an exponentially distributed number of
+ *           allocations, with mean -S
+ *   long    freed only at the end of the trace
+ *   phased  freed with the rest of its phase when the phase ends,
+ *           every -P allocations
+ *   fifo    freed in the order it was allocated, once -q younger
+ *           fifo blocks exist, as a consumer behind a producer would
+ *
+ * A share (-r) of the blocks also grows through a chain of up to -R
+ * reallocs, each -g times larger, while it lives. Time is counted in
+ * allocations. Every block still allocated at the end is freed, so the
+ * trace is balanced. The same seed always gives the same trace.
+ *
+ * usage: gentrace [options] <trace>
+ *   -n <n>       number of blocks to allocate (1000000)
+ *   -s <seed>    random seed (1)
+ *   -a <alpha>   power-law exponent of the sizes (1.5)
+ *   -m <bytes>   smallest size (8)
+ *   -M <bytes>   largest size (1048576)
+ *   -t <mix>     weights of the lifetimes (short=70,long=5,phased=15,fifo=10)
+ *   -S <n>       mean lifetime of short blocks, in allocations (100)
+ *   -P <n>       length of a phase, in allocations (10000)
+ *   -q <n>       fifo blocks in flight from producer to consumer (1000)
+ *   -r <pct>     percent of blocks that grow by realloc (5)
+ *   -R <n>       most reallocs in a chain (8)
+ *   -g <factor>  growth of each realloc (1.5)
+ *   -b           write a binary trace (see trace.h) instead of text
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Lifetimes of blocks */
+enum {SHORT, LONG, PHASED, FIFO, NUM_LIFETIMES};
+static char *lifetime_names[] = {"short", "long", "phased", "fifo"};
+
+/* A pending free or realloc, due at a given time */
+typedef struct {
+    uint64_t time;
+    uint32_t id;
+    uint32_t type;   /* FREE or REALLOC */
+} event_t;
+
+/* Parameters */
+static long num_blocks = 1000000;
+static uint64_t seed = 1;
+static double alpha = 1.5, min_size = 8, max_size = 1 << 20;
+static double weights[NUM_LIFETIMES] = {70, 5, 15, 10};
+static double short_mean = 100;
+static long phase_len = 10000, fifo_depth = 1000;
+static double chain_pct = 5, growth = 1.5;
+static int chain_len = 8;
+
+/* The trace being built */
+static traceop_t *ops;
+static size_t num_ops, max_ops;
+static uint32_t *sizes;         /* current size of each block, 0 once freed */
+static unsigned char *chains;   /* reallocs left in the chain of each block */
+static size_t live, peak;       /* bytes allocated now, and at most */
+
+/* Pending events, a binary min-heap ordered by time */
+static event_t *events;
+static size_t num_events, max_events;
+
+/* Blocks waiting to be freed: fifo in a ring, phased in a list */
+static uint32_t *fifo, *phase;
+static size_t fifo_head, fifo_count, phase_count;
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: gentrace [-n blocks] [-s seed] [-a alpha] [-m min] [-M max]\n"
+	    "                [-t short=w,long=w,phased=w,fifo=w] [-S mean] [-P phase]\n"
+	    "                [-q depth] [-r pct] [-R reallocs] [-g growth] [-b] <trace>\n");
+    exit(1);
+}
+
+/* splitmix64, so a seed gives the same trace everywhere */
+static uint64_t next_random(void)
+{
+    uint64_t z = (seed += 0x9E3779B97F4A7C15UL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform in (0, 1) */
+static double uniform(void)
+{
+    return ((next_random() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/* A size from the Pareto distribution bounded to [min_size, max_size] */
+static uint32_t power_law_size(void)
+{
+    double l = pow(min_size, alpha), h = pow(max_size, alpha);
+    double u = uniform();
+
+    return (uint32_t)pow((h * l) / (h - u * (h - l)), 1 / alpha);
+}
+
+static void emit(int type, uint32_t id, uint32_t size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : 1 << 20;
+	if ((ops = realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("realloc failed in emit");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].index = id;
+    ops[num_ops].size = size;
+    num_ops++;
+
+    live = live - sizes[id] + size;
+    sizes[id] = size;
+    if (live > peak)
+	peak = live;
+}
+
+static void push_event(uint64_t time, uint32_t id, uint32_t type)
+{
+    size_t i;
+    event_t e = {time, id, type};
+
+    if (num_events == max_events) {
+	max_events = max_events ? 2 * max_events : 4096;
+	if ((events = realloc(events, max_events * sizeof(event_t))) == NULL)
+	    unix_error("realloc failed in push_event");
+    }
+    for (i = num_events++; i > 0 && events[(i-1)/2].time > time; i = (i-1)/2)
+	events[i] = events[(i-1)/2];
+    events[i] = e;
+}
+
+static event_t pop_event(void)
+{
+    event_t top = events[0], last = events[--num_events];
+    size_t i = 0, child;
+
+    while ((child = 2*i + 1) < num_events) {
+	if (child + 1 < num_events && events[child+1].time < events[child].time)
+	    child++;
+	if (last.time <= events[child].time)
+	    break;
+	events[i] = events[child];
+	i = child;
+    }
+    events[i] = last;
+    return top;
+}
+
+static void free_block(uint32_t id)
+{
+    if (sizes[id] != 0)
+	emit(FREE, id, 0);
+}
+
+/* An exponentially distributed delay with the given mean, at least 1 */
+static uint64_t delay(double mean)
+{
+    return 1 + (uint64_t)(-log(uniform()) * mean);
+}
+
+/* Parse a lifetime mix such as short=70,fifo=30 into weights */
+static void parse_mix(char *arg)
+{
+    char *tok, *eq;
+    int i;
+
+    memset(weights, 0, sizeof(weights));
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+	if ((eq = strchr(tok, '=')) == NULL)
+	    usage();
+	*eq = '\0';
+	for (i = 0; i < NUM_LIFETIMES && strcmp(tok, lifetime_names[i]) != 0; i++);
+	if (i == NUM_LIFETIMES)
+	    usage();
+	weights[i] = atof(eq + 1);
+    }
+}
+
+static void write_trace(char *path, int binary)
+{
+    FILE *f;
+    trace_header_t hdr;
+    size_t i;
+
+    if ((f = fopen(path, binary ? "wb" : "w")) == NULL)
+	unix_error(path);
+    if (binary) {
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.sugg_heapsize = peak > UINT32_MAX ? UINT32_MAX : peak;
+	hdr.num_ids = num_blocks;
+	hdr.num_ops = num_ops;
+	hdr.weight = 1;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(ops, sizeof(traceop_t), num_ops, f) != num_ops)
+	    unix_error("fwrite failed in write_trace");
+    }
+    else {
+	fprintf(f, "%zu\n%ld\n%zu\n1\n", peak, num_blocks, num_ops);
+	for (i = 0; i < num_ops; i++) {
+	    if (ops[i].type == FREE)
+		fprintf(f, "f %u\n", ops[i].index);
+	    else
+		fprintf(f, "%c %u %u\n", ops[i].type == ALLOC ? 'a' : 'r',
+			ops[i].index, ops[i].size);
+	}
+    }
+    if (fclose(f) != 0)
+	unix_error(path);
+}
+
+int main(int argc, char **argv)
+{
+    int c, binary = 0, kind;
+    uint64_t now;
+    uint32_t id, size;
+    double total = 0, pick;
+    event_t e;
+    size_t i;
+
+    while ((c = getopt(argc, argv, "n:s:a:m:M:t:S:P:q:r:R:g:b")) != EOF) {
+	switch (c) {
+	case 'n': num_blocks = atol(optarg); break;
+	case 's': seed = strtoull(optarg, NULL, 0); break;
+	case 'a': alpha = atof(optarg); break;
+	case 'm': min_size = atof(optarg); break;
+	case 'M': max_size = atof(optarg); break;
+	case 't': parse_mix(optarg); break;
+	case 'S': short_mean = atof(optarg); break;
+	case 'P': phase_len = atol(optarg); break;
+	case 'q': fifo_depth = atol(optarg); break;
+	case 'r': chain_pct = atof(optarg); break;
+	case 'R': chain_len = atoi(optarg); break;
+	case 'g': growth = atof(optarg); break;
+	case 'b': binary = 1; break;
+	default: usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+    for (kind = 0; kind < NUM_LIFETIMES; kind++)
+	total += weights[kind];
+    if (num_blocks < 1 || num_blocks > (1L << 30) || alpha <= 0 || min_size < 1 ||
+	max_size < min_size || max_size > INT32_MAX || total <= 0 ||
+	phase_len < 1 || fifo_depth < 0 || chain_len < 0 || chain_len > 255 || growth < 1) {
+	fprintf(stderr, "gentrace: bad parameter\n");
+	exit(1);
+    }
+
+    if ((sizes = calloc(num_blocks, sizeof(uint32_t))) == NULL ||
+	(chains = calloc(num_blocks, 1)) == NULL ||
+	(fifo = malloc((fifo_depth + 1) * sizeof(uint32_t))) == NULL ||
+	(phase = malloc(phase_len * sizeof(uint32_t))) == NULL)
+	unix_error("malloc failed in main");
+
+    for (now = 0; now < num_blocks; now++) {
+	/* Make the frees and reallocs that are due by now */
+	while (num_events > 0 && events[0].time <= now) {
+	    e = pop_event();
+	    if (sizes[e.id] == 0)       /* freed before its realloc came up */
+		continue;
+	    if (e.type == FREE)
+		free_block(e.id);
+	    else {
+		size = fmin(sizes[e.id] * growth + 1, INT32_MAX);
+		emit(REALLOC, e.id, size);
+		if (--chains[e.id] > 0)
+		    push_event(now + delay(short_mean), e.id, REALLOC);
+	    }
+	}
+
+	/* The blocks of the phase that just ended */
+	if (now > 0 && now % phase_len == 0) {
+	    for (i = 0; i < phase_count; i++)
+		free_block(phase[i]);
+	    phase_count = 0;
+	}
+
+	/* Allocate the next block and decide when it is freed */
+	id = now;
+	emit(ALLOC, id, power_law_size());
+	pick = uniform() * total;
+	for (kind = 0; kind < NUM_LIFETIMES - 1 && pick >= weights[kind]; kind++)
+	    pick -= weights[kind];
+	switch (kind) {
+	case SHORT:
+	    push_event(now + delay(short_mean), id, FREE);
+	    break;
+	case LONG:
+	    break;
+	case PHASED:
+	    phase[phase_count++] = id;
+	    break;
+	case FIFO:
+	    fifo[(fifo_head + fifo_count++) % (fifo_depth + 1)] = id;
+	    if (fifo_count > fifo_depth) {
+		free_block(fifo[fifo_head]);
+		fifo_head = (fifo_head + 1) % (fifo_depth + 1);
+		fifo_count--;
+	    }
+	    break;
+	}
+	if (chain_len > 0 && uniform() * 100 < chain_pct) {
+	    chains[id] = 1 + next_random() % chain_len;
+	    push_event(now + delay(short_mean), id, REALLOC);
+	}
+    }
+
+    /* Free every block still allocated */
+    for (i = 0; i < num_blocks; i++)
+	free_block(i);
+
+    write_trace(argv[optind], binary);
+    fprintf(stderr, "%s: %ld blocks, %zu requests, peak %zu bytes\n",
+	    argv[optind], num_blocks, num_ops, peak);
+    return 0;
+}
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for RTLD_DEEPBIND and dlinfo */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -17,12 +18,23 @@
 #include <math.h>
 #include <inttypes.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "pagemap.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -32,6 +44,42 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MT_RUNS        3 /* best of MT_RUNS runs for each multithreaded replay */
+#define HANDOFF_SLOTS 1024 /* blocks in flight from a producer to its consumer */
+#define NUM_COUNTERS   7 /* hardware and software events counted with -P */
+#define BATCH_OPS    256 /* most requests in one batch of the batched replay (-B) */
+
+/* Ways to share a trace out among threads in the multithreaded replay (-M) */
+enum {MT_COPIES, MT_SPLIT, MT_HANDOFF};
+static char *mt_modes[] = {"copies", "split", "handoff", NULL};
+
+/* 
+ * Latency histograms are log-linear, as in HdrHistogram: each power of
+ * two is split into LAT_SUB_BUCKETS buckets, so a percentile is within
+ * 1/LAT_SUB_BUCKETS of the true latency, whatever their range.
+ */
+#define LAT_SUB_BITS    4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS     ((64 - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+/* Read the cycle counter, or a nanosecond clock where there is none */
+#if defined(__i386__) || defined(__x86_64__)
+#define TICKS "cycles"
+static inline uint64_t read_ticks(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+#define TICKS "ns"
+static inline uint64_t read_ticks(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+#endif
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
@@ -40,19 +88,16 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a treap keyed by lo */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges with lower addresses */
+    struct range_t *right; /* ranges with higher addresses */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* Heap priority of a range in the treap, a hash of its address */
+#define RANGE_PRIORITY(p) (((uintptr_t)(p)->lo * 0x9E3779B97F4A7C15UL) >> 32)
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -61,10 +106,23 @@ typedef struct {
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    void *map;           /* mapping of a binary trace that ops points into, or NULL */
+    size_t map_size;     /* length of that mapping */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
 } trace_t;
 
+/* The entry points of a malloc package other than through mm.h */
+typedef struct {
+    char *name;
+    int (*init)(void);      /* set up an empty, thread-safe heap, or NULL */
+    void (*reset)(void);    /* give the heap back, or NULL */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    int memlib;             /* gets its pages from memlib, so its heap can be measured */
+} allocator_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -73,8 +131,47 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    allocator_t *alloc;  /* for eval_alloc_speed */
+    int *ends;           /* for eval_mm_batch_speed, see batch_end */
+    size_t align;        /* for eval_mm_variant_speed, or 0 to use mm_malloc */
+    int sized;           /* for eval_mm_variant_speed, set to use mm_free_sized */
 } speed_t;
 
+/* Queue of blocks a producer thread passes to its consumer to free */
+typedef struct {
+    char *slots[HANDOFF_SLOTS];
+    size_t head __attribute__((aligned(64))); /* next slot the consumer takes */
+    size_t tail __attribute__((aligned(64))); /* next slot the producer fills */
+} handoff_t;
+
+/* Holds the params to one thread of the multithreaded replay */
+typedef struct {
+    trace_t *trace;            /* trace replayed by this thread */
+    allocator_t *alloc;        /* malloc package it is replayed with */
+    int *opnums;               /* requests this thread replays, or NULL for all */
+    int num_ops;               /* number of them */
+    handoff_t *queue;          /* blocks passed from producer to consumer, or NULL */
+    int consumer;              /* if set, only free what comes through queue */
+    char **blocks;             /* this thread's own array of block ptrs */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    int valid;                 /* were this thread's blocks left intact? */
+    long ops;                  /* requests this thread made */
+    struct timespec t0, t1;    /* when this thread started and finished */
+} thread_params_t;
+
+/* Histogram of the latencies of one request type */
+typedef struct {
+    uint64_t counts[LAT_BUCKETS];
+    uint64_t count;   /* number of requests counted */
+    uint64_t max;     /* largest latency counted */
+} latency_t;
+
+/* One of the slowest requests of a trace */
+typedef struct {
+    uint64_t ticks;  /* its latency */
+    int opnum;       /* its index in the trace */
+} slow_op_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -87,6 +184,17 @@ typedef struct {
 
     double inst_util;     /* instanteous space utilization for this trace (always 0 for libc) */
 
+    double reserved_util; /* overall utilization of the reserved heap, decommitted pages included (mm only) */
+
+    size_t huge_bytes;    /* bytes of the heap backed by huge pages when it was largest (mm with -H only) */
+
+    struct mm_stats heap; /* mm_stats when the heap was largest, with the counters for the whole trace (mm with -v only) */
+
+    double counters[NUM_COUNTERS]; /* events per request, -1 if not counted (mm with -P only) */
+
+    int reallocs;         /* number of realloc requests in the trace (mm only) */
+    int inplace;          /* number of them that mm_realloc resized in place (mm only) */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -105,14 +213,39 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+#define HW_CACHE(cache, result) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+/* The events counted with -P, in the order they are printed */
+static struct {
+    char *name;
+    uint32_t type;
+    uint64_t config;
+} counter_events[NUM_COUNTERS] = {
+    {"cycles",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instrs",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1D miss", PERF_TYPE_HW_CACHE, 
+     HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"LLC miss", PERF_TYPE_HW_CACHE, 
+     HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"dTLB miss", PERF_TYPE_HW_CACHE, 
+     HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {"br miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"faults",  PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int counter_fds[NUM_COUNTERS]; /* -1 where an event can not be counted */
+static int counters_user_only;        /* set if the kernel's share is not counted */
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
+static range_t *insert_range(range_t *t, range_t *p);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
@@ -126,12 +259,56 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats);
 static void eval_mm_speed(void *ptr);
 
+/* Routines for evaluating a malloc package on several threads at once */
+static allocator_t mm_allocator, libc_allocator;
+static double eval_threads(trace_t *trace, allocator_t *alloc, int mode,
+			   int nthreads, double *kops, int *valid);
+static void *eval_thread(void *ptr);
+static void print_thread_results(trace_t *trace, int tracenum, int mode,
+				 int max_threads, int run_libc);
+
+/* Routines for timing each request of the mm malloc package */
+static void eval_mm_latency(trace_t *trace, latency_t *hist, 
+			    slow_op_t *slow, int *n, int nslow);
+static void print_latency_results(trace_t *trace, int tracenum, int nslow);
+
+/* Routines for the batched replay */
+static int batch_end(trace_t *trace, int i);
+static int eval_mm_batch_valid(trace_t *trace, int tracenum, range_t **ranges, 
+			       int *ends);
+static void eval_mm_batch_speed(void *ptr);
+static void print_batch_results(trace_t *trace, int tracenum, range_t **ranges, 
+				stats_t *stats);
+
+/* Routines for the replays with sized frees and aligned mallocs */
+static int eval_mm_variant_valid(trace_t *trace, int tracenum, range_t **ranges, 
+				 size_t align, int sized);
+static void eval_mm_variant_speed(void *ptr);
+static void print_variant_results(trace_t *trace, int tracenum, range_t **ranges, 
+				  stats_t *stats, size_t align, int sized);
+
+/* Routines for counting hardware events while mm malloc runs (-P) */
+static int open_counters(void);
+static void eval_mm_counters(speed_t *speed_params, double *counts);
+
+/* Routines for loading and evaluating other malloc packages (--alloc) */
+static allocator_t *load_allocator(char *path);
+static int eval_alloc_valid(trace_t *trace, int tracenum, allocator_t *alloc);
+static double eval_alloc_util(trace_t *trace, allocator_t *alloc, stats_t *stats);
+static void eval_alloc_speed(void *ptr);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printreallocs(int n, stats_t *stats);
+static void printreserved(int n, stats_t *stats);
+static void printhugepages(int n, stats_t *stats);
+static void printheapstats(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printcomparison(int ntraces, int n, allocator_t **allocs, stats_t **stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -153,7 +330,23 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int max_threads = 0; /* If set, replay on up to this many threads (-T) */
+    int mt_mode = MT_COPIES; /* How the trace is shared out among them (-M) */
+    int nslow = -1;      /* If set, time each request, list this many slowest (-L) */
+    int counters = 0;    /* If set, count hardware events per request (-P) */
+    int batched = 0;     /* If set, also replay with batched requests (-B) */
+    int sized = 0;       /* If set, also replay with sized frees (-S) */
+    size_t align = 0;    /* If set, also replay with mallocs aligned to this (-a) */
+    unsigned long growth_min, growth_max; /* Bounds of heap growth in pages (-G) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    allocator_t **allocs = NULL; /* mm and the packages loaded with --alloc */
+    stats_t **alloc_stats = NULL;/* stats of each of them for each trace */
+    int num_allocs = 1;  /* number of packages in allocs */
+    int a;
+    static struct option long_options[] = {
+	{"alloc", required_argument, NULL, 'A'},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, inst_util, avg_mm_inst_util, avg_mm_util, avg_mm_throughput;
@@ -163,8 +356,16 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    if ((allocs = (allocator_t **)malloc(sizeof(allocator_t *))) == NULL)
+	unix_error("malloc failed in main");
+    allocs[0] = &mm_allocator;
+    while ((c = getopt_long(argc, argv, "f:t:T:M:L:A:a:G:hvVglHDPBS", long_options, NULL)) != EOF) {
         switch (c) {
+        case 'A': /* Also evaluate the malloc package in this shared library */
+            if ((allocs = realloc(allocs, (num_allocs + 1) * sizeof(allocator_t *))) == NULL)
+		unix_error("realloc failed in main");
+            allocs[num_allocs++] = load_allocator(optarg);
+            break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -183,9 +384,52 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'T': /* Replay each trace on up to n threads at once */
+            max_threads = atoi(optarg);
+            if (max_threads < 1)
+                app_error("-T needs at least one thread");
+            break;
+        case 'M': /* Share each trace out among the threads of -T this way */
+            for (mt_mode = 0; mt_modes[mt_mode] != NULL; mt_mode++)
+                if (strcmp(optarg, mt_modes[mt_mode]) == 0)
+                    break;
+            if (mt_modes[mt_mode] == NULL)
+                app_error("-M needs one of copies, split or handoff");
+            break;
+        case 'L': /* Time each request and list the n slowest of each trace */
+            nslow = atoi(optarg);
+            if (nslow < 0)
+                app_error("-L needs a count of zero or more");
+            break;
+        case 'a': /* Also replay with every malloc made by mm_memalign */
+            align = strtoul(optarg, NULL, 0);
+            if (align < 16 || (align & (align - 1)) != 0)
+                app_error("-a needs a power of 2 of at least 16");
+            break;
+        case 'G': /* Bound the chunks the heap grows by to <min>,<max> pages */
+            if (sscanf(optarg, "%lu,%lu", &growth_min, &growth_max) != 2 ||
+                growth_min < 1 || growth_max < growth_min)
+                app_error("-G needs <min>,<max> pages with 1 <= min <= max");
+            mm_set_growth(growth_min * mem_pagesize(), growth_max * mem_pagesize());
+            break;
+        case 'S': /* Also replay with every free made by mm_free_sized */
+            sized = 1;
+            break;
+        case 'B': /* Also replay with runs of requests batched */
+            batched = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'H': /* Map large heap regions with transparent huge pages */
+            mem_set_hugepages(1);
+            break;
+        case 'D': /* Decommit the idle pages of large free blocks */
+            mm_set_decommit(1);
+            break;
+        case 'P': /* Count hardware events per request with perf_event_open */
+            counters = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -263,22 +507,30 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
+    if (counters && open_counters() == 0) {
+	printf("No performance counters could be opened (%s), ignoring -P\n", 
+	       strerror(errno));
+	counters = 0;
+    }
+
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
 	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges, &mm_stats[i]);
 	if (mm_stats[i].valid) {
 	    if (verbose > 1)
 		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i].inst_util);
+	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i]);
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    if (counters)
+		eval_mm_counters(&speed_params, mm_stats[i].counters);
 	}
 	free_trace(trace);
     }
@@ -287,6 +539,125 @@ int main(int argc, char **argv)
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printreallocs(num_tracefiles, mm_stats);
+	printreserved(num_tracefiles, mm_stats);
+	printhugepages(num_tracefiles, mm_stats);
+	printheapstats(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* Display the hardware events per request */
+    if (counters) {
+	printf("Events per request of mm malloc%s:\n", 
+	       counters_user_only ? " (user mode only)" : "");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally evaluate the packages loaded with --alloc in the same
+     * way, and print them side by side with mm malloc
+     */
+    if (num_allocs > 1) {
+	if ((alloc_stats = (stats_t **)malloc(num_allocs * sizeof(stats_t *))) == NULL)
+	    unix_error("malloc failed in main");
+	alloc_stats[0] = mm_stats;
+	for (a = 1; a < num_allocs; a++) {
+	    if (verbose > 1)
+		printf("\nTesting %s\n", allocs[a]->name);
+	    if ((alloc_stats[a] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+		unix_error("alloc_stats calloc in main failed");
+	    for (i=0; i < num_tracefiles; i++) {
+		trace = read_trace(tracedir, tracefiles[i]);
+		alloc_stats[a][i].ops = trace->num_ops;
+		alloc_stats[a][i].valid = eval_alloc_valid(trace, i, allocs[a]);
+		if (alloc_stats[a][i].valid) {
+		    if (allocs[a]->memlib)
+			alloc_stats[a][i].util = eval_alloc_util(trace, allocs[a], &alloc_stats[a][i]);
+		    speed_params.trace = trace;
+		    speed_params.alloc = allocs[a];
+		    alloc_stats[a][i].secs = fsecs(eval_alloc_speed, &speed_params);
+		}
+		free_trace(trace);
+	    }
+	}
+	printf("Comparison of malloc packages:\n");
+	printcomparison(num_tracefiles, num_allocs, allocs, alloc_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every trace on 1 to max_threads threads at once
+     */
+    if (max_threads) {
+	printf("Multithreaded replay (%s) of mm malloc:\n", mt_modes[mt_mode]);
+	printf("%5s%8s%9s%9s%9s%8s%7s", 
+	       "trace", "threads", "Kops", "min thr", "max thr", "speedup", "eff");
+	if (run_libc)
+	    printf("%9s%7s%8s", "libc", "eff", "mm/libc");
+	printf("\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    print_thread_results(trace, i, mt_mode, max_threads, run_libc);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally time every request and print the tail latencies
+     */
+    if (nslow >= 0) {
+	printf("Latency of mm malloc requests (" TICKS "):\n");
+	printf("%5s%9s%9s%8s%8s%8s%10s\n", 
+	       "trace", "request", "count", "p50", "p99", "p999", "max");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    print_latency_results(trace, i, nslow);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every trace with runs of mallocs of one size
+     * and runs of frees made as batches
+     */
+    if (batched) {
+	printf("Batched replay of mm malloc:\n");
+	printf("%5s%7s%10s%10s%9s%9s%8s\n", 
+	       "trace", "valid", "mallocs/b", "frees/b", "Kops", "batched", "speedup");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    print_batch_results(trace, i, &ranges, &mm_stats[i]);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every trace with sized frees and with aligned
+     * mallocs, side by side with the ordinary replay
+     */
+    if (sized || align) {
+	printf("Sized free and aligned malloc replays of mm malloc:\n");
+	printf("%5s%9s", "trace", "Kops");
+	if (sized)
+	    printf("%7s%9s%8s", "valid", "sized", "speedup");
+	if (align)
+	    printf("%7s%9s%8s", "valid", "aligned", "speedup");
+	printf("\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    print_variant_results(trace, i, &ranges, &mm_stats[i], align, sized);
+	    free_trace(trace);
+	}
 	printf("\n");
     }
 
@@ -348,22 +719,24 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is a
+ * treap ordered by the low address of each payload, so each
+ * operation takes O(log n) expected time for n allocated blocks.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *below = NULL, *above = NULL;
     char msg[MAXLINE];
     size_t page_size = mem_pagesize(), i;
 
@@ -393,46 +766,106 @@ static int add_range(range_t **ranges, char *lo, int size,
       return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
+    /* 
+     * The payload must not overlap any other payloads. Since they do
+     * not overlap each other, only the payload starting at or right 
+     * below lo and the one starting right above it need to be checked.
+     */
+    for (p = *ranges;  p != NULL; ) {
+        if (p->lo <= lo) {
+            below = p;
+            p = p->right;
+        }
+        else {
+            above = p;
+            p = p->left;
         }
     }
+    p = (below != NULL && below->hi >= lo) ? below
+        : (above != NULL && above->lo <= hi) ? above : NULL;
+    if (p != NULL) {
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, p->lo, p->hi);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
+    }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    *ranges = insert_range(*ranges, p);
     return 1;
 }
 
+/*
+ * insert_range - Insert range p into the treap rooted at t and return
+ *     the new root, rotating p up while its priority is higher
+ */
+static range_t *insert_range(range_t *t, range_t *p)
+{
+    range_t *child;
+
+    if (t == NULL)
+        return p;
+    if (p->lo < t->lo) {
+        child = t->left = insert_range(t->left, p);
+        if (RANGE_PRIORITY(child) > RANGE_PRIORITY(t)) {
+            t->left = child->right;
+            child->right = t;
+            return child;
+        }
+    }
+    else {
+        child = t->right = insert_range(t->right, p);
+        if (RANGE_PRIORITY(child) > RANGE_PRIORITY(t)) {
+            t->right = child->left;
+            child->left = t;
+            return child;
+        }
+    }
+    return t;
+}
+
 /* 
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **link = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            free(p);
-            break;
+    /* Find the link to the range */
+    while (*link != NULL && (*link)->lo != lo)
+        link = lo < (*link)->lo ? &(*link)->left : &(*link)->right;
+    if ((p = *link) == NULL)
+        return;
+
+    /* Rotate it down until it has at most one child, then unlink it */
+    while (p->left != NULL && p->right != NULL) {
+        range_t *child;
+        if (RANGE_PRIORITY(p->left) > RANGE_PRIORITY(p->right)) {
+            child = p->left;
+            p->left = child->right;
+            child->right = p;
+            *link = child;
+            link = &child->right;
+        }
+        else {
+            child = p->right;
+            p->right = child->left;
+            child->left = p;
+            *link = child;
+            link = &child->left;
         }
-        prevpp = &(p->next);
     }
+    *link = p->left != NULL ? p->left : p->right;
+    free(p);
 }
 
 /*
@@ -440,13 +873,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free(p);
     *ranges = NULL;
 }
 
@@ -456,32 +889,63 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * map_trace - map a binary trace read-only and point trace->ops into it,
+ *     checking that every request in it can be replayed
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void map_trace(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    trace_header_t *hdr;
+    int i;
+
+    if (fstat(fileno(tracefile), &st) < 0 || st.st_size < (off_t)sizeof(trace_header_t)) {
+	sprintf(msg, "Could not stat %s in read_trace", path);
+	unix_error(msg);
+    }
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE,
+		      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED) {
+	sprintf(msg, "Could not mmap %s in read_trace", path);
+	unix_error(msg);
+    }
+    hdr = trace->map;
+    trace->sugg_heapsize = hdr->sugg_heapsize; /* not used */
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;               /* not used */
+    trace->ops = (traceop_t *)(hdr + 1);
+    if (trace->map_size != sizeof(trace_header_t) + 
+	(size_t)trace->num_ops * sizeof(traceop_t)) {
+	printf("Binary tracefile %s is truncated or has a bad header\n", path);
+	exit(1);
+    }
+
+    /* Every request is replayed straight from the mapping, so check
+       its type, and that its index is within blocks and block_sizes */
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type > REALLOC || trace->ops[i].index >= (unsigned)trace->num_ids) {
+	    printf("Binary tracefile %s has a bad request %d (type %d, index %u of %d ids)\n",
+		   path, i, trace->ops[i].type, trace->ops[i].index, trace->num_ids);
+	    exit(1);
+	}
+    }
+
+    /* The requests are replayed in order, so have them read in ahead */
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+    madvise(trace->map, trace->map_size, MADV_WILLNEED);
+}
+
+/*
+ * read_ops - read the request lines of a text trace into trace->ops
+ */
+static void read_ops(trace_t *trace, FILE *tracefile, char *path)
 {
-    FILE *tracefile;
-    trace_t *trace;
     char type[MAXLINE];
-    char path[MAXLINE];
     unsigned index, size;
     unsigned max_index = 0;
     unsigned op_index;
 
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -492,16 +956,6 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -525,6 +979,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -534,20 +989,69 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	op_index++;
 	
     }
-    fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace (see trace.h) is mapped rather than read, and its requests
+ *     are replayed straight from the mapping.
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    char magic[sizeof(TRACE_MAGIC) - 1];
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+	
+    /* Read the trace file header */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fread(magic, sizeof(magic), 1, tracefile) == 1 &&
+	memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0)
+	map_trace(trace, tracefile, path);
+    else {
+	rewind(tracefile);
+	read_ops(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
     
     return trace;
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or mapped) in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -561,11 +1065,11 @@ void free_trace(trace_t *trace)
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats) 
 {
-    int i;
+    int i, j;
     int index;
-    int size;
+    int size, oldsize;
     char *newp;
     char *oldp;
     char *p;
@@ -614,12 +1118,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
-        case REALLOC: /* mm_malloc + mm_free */
+        case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    oldsize = trace->block_sizes[index];
+	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 
@@ -630,9 +1135,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 
+	    /* The old data must have been kept, up to the smaller size */
+	    for (j = 0; j < size && j < oldsize; j++) {
+		if (newp[j] != (char)(index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+	    }
 	    memset(newp, index & 0xFF, size);
 
-            mm_free(oldp);
+	    /* Count the copies avoided by resizing in place */
+	    stats->reallocs++;
+	    if (newp == oldp)
+		stats->inplace++;
 
 	    /* Remember region */
 	    trace->blocks[index] = newp;
@@ -668,14 +1184,23 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
+ *   The heap size only counts committed pages; the utilization of the
+ *   reserved heap, which also counts decommitted pages, is stored in
+ *   stats along with the instantaneous utilization. With huge pages on,
+ *   the bytes backed by huge pages are sampled each time the heap has
+ *   grown by another huge page, and the largest sample is stored too.
+ *   With -v, mm_stats is also stored for the largest heap, with its
+ *   counters taken at the end of the trace.
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats)
 {   
     int i;
     int index;
     int size, newsize, oldsize;
-    size_t max_total_size = 0, max_heap_size = 0;
+    size_t max_total_size = 0, max_heap_size = 0, max_reserved_size = 0;
+    size_t sampled_size = 0, huge_bytes;
+    struct mm_stats end;
     size_t heap_size = 0, total_size = 0;
     double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
     int ratio_exp;
@@ -706,17 +1231,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 
             break;
 
-	case REALLOC: /* mm_mealloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(newsize)) == NULL)
+	    if ((newp = mm_realloc(oldp, newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
-            mm_free(oldp);
-
 	    /* Remember region and size */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = newsize;
@@ -752,8 +1275,19 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
                           : max_total_size);
 
         heap_size = mem_heapsize();
-        if (heap_size > max_heap_size)
+        if (heap_size > max_heap_size) {
           max_heap_size = heap_size;
+          if (verbose)
+            mm_stats(&stats->heap);
+        }
+        if (mem_reservedsize() > max_reserved_size)
+          max_reserved_size = mem_reservedsize();
+        if (mem_hugepages() && heap_size >= sampled_size + HPAGE_SIZE) {
+          sampled_size = heap_size;
+          huge_bytes = mem_hugepage_bytes();
+          if (huge_bytes > stats->huge_bytes)
+            stats->huge_bytes = huge_bytes;
+        }
 
         ratio = (double)(total_size + 1) / (heap_size + 1);
 
@@ -768,13 +1302,23 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
         // printf("%ld %ld %f\n", total_size, heap_size, ratio);
     }
 
+    if (verbose) {
+        mm_stats(&end);
+        stats->heap.longest_scan = end.longest_scan;
+        stats->heap.splits = end.splits;
+        stats->heap.coalesces = end.coalesces;
+        stats->heap.maps = end.maps;
+        stats->heap.unmaps = end.unmaps;
+    }
+
     mem_reset();
 
     ratio = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
 
     // printf("%ld %f\n", max_total_size, ratio);
 
-    *inst_ratio = ratio;
+    stats->inst_util = ratio;
+    stats->reserved_util = (double)max_total_size / max_reserved_size;
 
     return (double)max_total_size / max_heap_size;;
 }
@@ -806,13 +1350,12 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
-	case REALLOC: /* mm_malloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_malloc(newsize)) == NULL)
+            if ((newp = mm_realloc(oldp, newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
-            mm_free(oldp);
             trace->blocks[index] = newp;
             break;
 
@@ -830,59 +1373,917 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * The entry points of mm malloc for the multithreaded replay, which
+ * runs the package in its thread-safe mode
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static int mm_threads_init(void)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    mm_set_threaded(1);
+    return mm_init();
+}
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+static void mm_threads_reset(void)
+{
+    mem_reset();
+    mm_set_threaded(0);
+}
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
+static allocator_t mm_allocator = {
+    "mm", mm_threads_init, mm_threads_reset, mm_malloc, mm_free, mm_realloc, 1
+};
 
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
-	    break;
+/* libc malloc needs no setting up, and keeps its heap between replays */
+static allocator_t libc_allocator = {
+    "libc", NULL, NULL, malloc, free, realloc, 0
+};
 
-	default:
-	    app_error("invalid operation type  in eval_libc_valid");
-	}
-    }
+/*
+ * handoff_put - Pass block p from a producer thread to its consumer,
+ *     waiting while the queue is full. NULL tells the consumer to stop.
+ */
+static void handoff_put(handoff_t *q, char *p)
+{
+    size_t tail = q->tail;
 
-    return 1;
+    while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == HANDOFF_SLOTS)
+	sched_yield();
+    q->slots[tail % HANDOFF_SLOTS] = p;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * handoff_get - Take the next block a producer passed on, waiting
+ *     while the queue is empty
  */
-static void eval_libc_speed(void *ptr)
+static char *handoff_get(handoff_t *q)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    size_t head = q->head;
+    char *p;
+
+    while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+	sched_yield();
+    p = q->slots[head % HANDOFF_SLOTS];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return p;
+}
+
+/*
+ * eval_threads - Replay the trace on nthreads threads at once with the
+ *    given malloc package, and return the wall clock time. How the
+ *    trace is shared out depends on the mode:
+ *
+ *    MT_COPIES  every thread replays the whole trace
+ *    MT_SPLIT   thread t replays the requests for the t-th of nthreads
+ *               equal ranges of ids, so the threads share one replay
+ *    MT_HANDOFF threads are paired, and the first of each pair replays
+ *               the trace but passes every block it frees to the
+ *               second, which frees it
+ *
+ *    Each thread has its own set of blocks. The throughput of thread t
+ *    is left in kops[t]. valid is cleared if any thread found one of
+ *    its blocks overwritten by another.
+ */
+static double eval_threads(trace_t *trace, allocator_t *alloc, int mode,
+			   int nthreads, double *kops, int *valid)
+{
+    int i, t, lo, hi;
+    pthread_t *tids;
+    thread_params_t *params;
+    handoff_t *queues = NULL;
+    pthread_barrier_t start;
+    double t0 = DBL_MAX, t1 = 0, secs;
+
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(params = (thread_params_t *)calloc(nthreads, sizeof(thread_params_t))) == NULL)
+	unix_error("malloc failed in eval_threads");
+    if (mode == MT_HANDOFF &&
+	(queues = (handoff_t *)aligned_alloc(64, nthreads / 2 * sizeof(handoff_t))) == NULL)
+	unix_error("aligned_alloc failed in eval_threads");
+
+    /* Reset the heap and initialize the malloc package */
+    if (alloc->init != NULL && alloc->init() < 0) 
+	app_error("init failed in eval_threads");
+
+    /* Share out the requests, start every thread, and release them all at once */
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (t = 0; t < nthreads; t++) {
+	params[t].trace = trace;
+	params[t].alloc = alloc;
+	params[t].start = &start;
+	params[t].valid = 1;
+	if ((params[t].blocks = (char **)calloc(trace->num_ids, sizeof(char *))) == NULL)
+	    unix_error("malloc failed in eval_threads");
+	if (mode == MT_SPLIT) {
+	    lo = (long)trace->num_ids * t / nthreads;
+	    hi = (long)trace->num_ids * (t + 1) / nthreads;
+	    if ((params[t].opnums = (int *)malloc(trace->num_ops * sizeof(int))) == NULL)
+		unix_error("malloc failed in eval_threads");
+	    for (i = 0; i < trace->num_ops; i++)
+		if (trace->ops[i].index >= lo && trace->ops[i].index < hi)
+		    params[t].opnums[params[t].num_ops++] = i;
+	}
+	else
+	    params[t].num_ops = trace->num_ops;
+	if (mode == MT_HANDOFF) {
+	    params[t].queue = &queues[t / 2];
+	    params[t].consumer = t % 2;
+	    queues[t / 2].head = queues[t / 2].tail = 0;
+	}
+	if (pthread_create(&tids[t], NULL, eval_thread, &params[t]) != 0)
+	    unix_error("pthread_create failed in eval_threads");
+    }
+    pthread_barrier_wait(&start);
+    for (t = 0; t < nthreads; t++)
+	pthread_join(tids[t], NULL);
+
+    /* The replay ran from when the first thread started to when the last one finished */
+    *valid = 1;
+    for (t = 0; t < nthreads; t++) {
+	*valid &= params[t].valid;
+	t0 = fmin(t0, params[t].t0.tv_sec + params[t].t0.tv_nsec / 1e9);
+	t1 = fmax(t1, params[t].t1.tv_sec + params[t].t1.tv_nsec / 1e9);
+	secs = (params[t].t1.tv_sec - params[t].t0.tv_sec) + 
+	    (params[t].t1.tv_nsec - params[t].t0.tv_nsec) / 1e9;
+	kops[t] = params[t].ops / 1e3 / secs;
+	free(params[t].blocks);
+	free(params[t].opnums);
+    }
+    pthread_barrier_destroy(&start);
+    free(queues);
+    free(params);
+    free(tids);
+
+    if (alloc->reset != NULL)
+	alloc->reset();
+
+    return t1 - t0;
+}
+
+/*
+ * eval_thread - Body of one thread of eval_threads. It replays its
+ *    requests, tagging the first and last byte of every block with its
+ *    index and checking the tags are still there when the block is
+ *    freed or reallocated. The blocks still allocated at the end are
+ *    freed once the clock has stopped.
+ */
+static void *eval_thread(void *ptr)
+{
+    thread_params_t *params = (thread_params_t *)ptr;
+    trace_t *trace = params->trace;
+    allocator_t *alloc = params->alloc;
+    char **blocks = params->blocks;
+    int i, opnum, index, size;
+    char *p, *oldp;
+
+    pthread_barrier_wait(params->start);
+    clock_gettime(CLOCK_MONOTONIC, &params->t0);
+
+    /* A consumer frees whatever its producer passes on */
+    if (params->consumer) {
+	while ((p = handoff_get(params->queue)) != NULL) {
+	    alloc->free(p);
+	    params->ops++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &params->t1);
+	return NULL;
+    }
+
+    for (i = 0;  i < params->num_ops;  i++) {
+	opnum = params->opnums ? params->opnums[i] : i;
+	index = trace->ops[opnum].index;
+	size = trace->ops[opnum].size;
+
+        switch (trace->ops[opnum].type) {
+
+        case ALLOC: /* malloc */
+            if ((p = alloc->malloc(size)) == NULL)
+		app_error("malloc error in eval_thread");
+	    p[0] = p[size-1] = index & 0xFF;
+            blocks[index] = p;
+	    params->ops++;
+            break;
+
+	case REALLOC: /* realloc */
+	    oldp = blocks[index];
+	    if (oldp[0] != (char)(index & 0xFF))
+		params->valid = 0;
+            if ((p = alloc->realloc(oldp, size)) == NULL)
+		app_error("realloc error in eval_thread");
+	    p[0] = p[size-1] = index & 0xFF;
+            blocks[index] = p;
+	    params->ops++;
+            break;
+
+        case FREE: /* free, or pass on to the consumer */
+            p = blocks[index];
+	    if (p[0] != (char)(index & 0xFF))
+		params->valid = 0;
+	    blocks[index] = NULL;
+	    if (params->queue != NULL)
+		handoff_put(params->queue, p);
+	    else {
+		alloc->free(p);
+		params->ops++;
+	    }
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_thread");
+        }
+    }
+    if (params->queue != NULL)
+	handoff_put(params->queue, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &params->t1);
+
+    for (index = 0; index < trace->num_ids; index++)
+	if (blocks[index] != NULL)
+	    alloc->free(blocks[index]);
+    return NULL;
+}
+
+/*
+ * best_threads - Run eval_threads MT_RUNS times and keep the fastest
+ *    run. Returns its aggregate throughput in Kops and leaves the
+ *    smallest and largest per-thread throughput in min_kops and
+ *    max_kops. Reports an error if a block was overwritten.
+ */
+static double best_threads(trace_t *trace, int tracenum, allocator_t *alloc, 
+			   int mode, int nthreads, double *min_kops, double *max_kops)
+{
+    int run, t, valid, all_valid = 1;
+    double secs, best = DBL_MAX, *kops, *best_kops;
+
+    if ((kops = (double *)malloc(2 * nthreads * sizeof(double))) == NULL)
+	unix_error("malloc failed in best_threads");
+    best_kops = kops + nthreads;
+
+    for (run = 0; run < MT_RUNS; run++) {
+	secs = eval_threads(trace, alloc, mode, nthreads, kops, &valid);
+	all_valid &= valid;
+	if (secs < best) {
+	    best = secs;
+	    memcpy(best_kops, kops, nthreads * sizeof(double));
+	}
+    }
+    if (!all_valid) {
+	errors++;
+	printf("ERROR [trace %d]: a block was overwritten with %d threads of %s malloc\n", 
+	       tracenum, nthreads, alloc->name);
+    }
+
+    *min_kops = DBL_MAX;
+    *max_kops = 0;
+    for (t = 0; t < nthreads; t++) {
+	*min_kops = fmin(*min_kops, best_kops[t]);
+	*max_kops = fmax(*max_kops, best_kops[t]);
+    }
+    if (verbose > 1) {
+	printf("%s malloc, %d threads, Kops of each thread:", alloc->name, nthreads);
+	for (t = 0; t < nthreads; t++)
+	    printf(" %.0f", best_kops[t]);
+	printf("\n");
+    }
+    free(kops);
+
+    /* Copies and handoff pairs each replay the whole trace */
+    if (mode == MT_COPIES)
+	return nthreads * (double)trace->num_ops / 1e3 / best;
+    if (mode == MT_HANDOFF)
+	return nthreads / 2 * (double)trace->num_ops / 1e3 / best;
+    return trace->num_ops / 1e3 / best;
+}
+
+/*
+ * print_thread_results - Replay the trace on 1, 2, 4, ... threads up
+ *    to max_threads (2, 4, ... in pairs for MT_HANDOFF) and print the
+ *    aggregate throughput of each, the throughput of the slowest and
+ *    fastest thread, and the speedup and scaling efficiency over the
+ *    fewest threads. With run_libc the aggregate throughput and
+ *    efficiency of libc malloc are printed too. Each line is the best
+ *    of MT_RUNS.
+ */
+static void print_thread_results(trace_t *trace, int tracenum, int mode,
+				 int max_threads, int run_libc)
+{
+    int nthreads, step = (mode == MT_HANDOFF) ? 2 : 1;
+    int last = max_threads / step * step;  /* handoff needs whole pairs */
+    double kops, min_kops, max_kops, base_kops = 0;
+    double libc_kops = 0, libc_min_kops, libc_max_kops, libc_base_kops = 0;
+
+    for (nthreads = step; nthreads <= last; 
+	 nthreads = (nthreads*2 > last && nthreads < last) ? last : nthreads*2) {
+	kops = best_threads(trace, tracenum, &mm_allocator, mode, nthreads, 
+			    &min_kops, &max_kops);
+	if (run_libc)
+	    libc_kops = best_threads(trace, tracenum, &libc_allocator, mode, nthreads, 
+				     &libc_min_kops, &libc_max_kops);
+	if (nthreads == step) {
+	    base_kops = kops;
+	    libc_base_kops = libc_kops;
+	}
+	printf("%5d%8d%9.0f%9.0f%9.0f%8.2f%6.0f%%", 
+	       tracenum, nthreads, kops, min_kops, max_kops, 
+	       kops / base_kops, 100 * kops / (base_kops * nthreads / step));
+	if (run_libc)
+	    printf("%9.0f%6.0f%%%8.2f", libc_kops, 
+		   100 * libc_kops / (libc_base_kops * nthreads / step), kops / libc_kops);
+	printf("\n");
+    }
+}
+
+/*****************************************************************
+ * The following routines time every request of a trace on its own,
+ * to find the tail latencies that the throughput numbers hide.
+ ****************************************************************/
+
+/* Bucket of latency v; values below LAT_SUB_BUCKETS get a bucket each */
+static inline int latency_bucket(uint64_t v)
+{
+    int e;
+
+    if (v < LAT_SUB_BUCKETS)
+	return v;
+    e = 63 - __builtin_clzll(v);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS + 
+	((v >> (e - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+/* Largest latency that falls in bucket b */
+static uint64_t latency_bucket_max(int b)
+{
+    int e = b / LAT_SUB_BUCKETS + LAT_SUB_BITS - 1;
+
+    if (b < LAT_SUB_BUCKETS)
+	return b;
+    return (((uint64_t)(LAT_SUB_BUCKETS + b % LAT_SUB_BUCKETS + 1)) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/* The latency that fraction q of the requests counted in h do not exceed */
+static uint64_t latency_percentile(latency_t *h, double q)
+{
+    uint64_t rank = (uint64_t)ceil(q * h->count), seen = 0;
+    int b;
+
+    if (rank == 0)
+	rank = 1;
+    for (b = 0; b < LAT_BUCKETS; b++) {
+	seen += h->counts[b];
+	if (seen >= rank)
+	    return latency_bucket_max(b) < h->max ? latency_bucket_max(b) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ * add_slow_op - Keep request opnum if it is among the nslow slowest
+ *     so far. slow is a min-heap of *n requests, ordered by ticks.
+ */
+static void add_slow_op(slow_op_t *slow, int *n, int nslow, uint64_t ticks, int opnum)
+{
+    int i = *n, child;
+    slow_op_t tmp;
+
+    if (*n < nslow) {   /* sift the new request up */
+	slow[(*n)++] = (slow_op_t){ticks, opnum};
+	for (; i > 0 && slow[(i-1)/2].ticks > slow[i].ticks; i = (i-1)/2) {
+	    tmp = slow[i];
+	    slow[i] = slow[(i-1)/2];
+	    slow[(i-1)/2] = tmp;
+	}
+	return;
+    }
+    if (nslow == 0 || ticks <= slow[0].ticks)
+	return;
+    slow[0] = (slow_op_t){ticks, opnum};   /* replace the fastest, sift it down */
+    for (i = 0; (child = 2*i + 1) < nslow; i = child) {
+	if (child + 1 < nslow && slow[child+1].ticks < slow[child].ticks)
+	    child++;
+	if (slow[i].ticks <= slow[child].ticks)
+	    break;
+	tmp = slow[i];
+	slow[i] = slow[child];
+	slow[child] = tmp;
+    }
+}
+
+/*
+ * eval_mm_latency - Replay the trace once, timing every request on its
+ *     own, and count each latency in the histogram of its request type.
+ *     The nslow slowest requests are left in slow, and their number in
+ *     *n.
+ */
+static void eval_mm_latency(trace_t *trace, latency_t *hist, 
+			    slow_op_t *slow, int *n, int nslow)
+{
+    int i, index, size;
+    char *p;
+    uint64_t t0, t1;
+
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    t0 = read_ticks();
+            p = mm_malloc(size);
+	    t1 = read_ticks();
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    t0 = read_ticks();
+            p = mm_realloc(trace->blocks[index], size);
+	    t1 = read_ticks();
+	    if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+	    p = trace->blocks[index];
+	    t0 = read_ticks();
+            mm_free(p);
+	    t1 = read_ticks();
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+        }
+
+	hist[trace->ops[i].type].counts[latency_bucket(t1 - t0)]++;
+	hist[trace->ops[i].type].count++;
+	if (t1 - t0 > hist[trace->ops[i].type].max)
+	    hist[trace->ops[i].type].max = t1 - t0;
+	add_slow_op(slow, n, nslow, t1 - t0, i);
+    }
+
+    mem_reset();
+}
+
+static int by_ticks(const void *a, const void *b)
+{
+    const slow_op_t *x = a, *y = b;
+    return x->ticks > y->ticks ? -1 : x->ticks < y->ticks;
+}
+
+/*
+ * print_latency_results - Print the p50, p99, p999 and max latency of
+ *     each request type of the trace, followed by its nslow slowest
+ *     requests with their line numbers in the trace file.
+ */
+static void print_latency_results(trace_t *trace, int tracenum, int nslow)
+{
+    static char *names[] = {"malloc", "free", "realloc"}; /* by request type */
+    latency_t *hist;
+    slow_op_t *slow;
+    traceop_t *op;
+    int i, n = 0;
+
+    if ((hist = calloc(3, sizeof(latency_t))) == NULL ||
+	(slow = malloc((nslow + 1) * sizeof(slow_op_t))) == NULL)
+	unix_error("malloc failed in print_latency_results");
+
+    eval_mm_latency(trace, hist, slow, &n, nslow);
+
+    for (i = ALLOC; i <= REALLOC; i++) {
+	latency_t *h = &hist[i];
+	if (h->count == 0)
+	    continue;
+	printf("%5d%9s%9" PRIu64 "%8" PRIu64 "%8" PRIu64 "%8" PRIu64 "%10" PRIu64 "\n",
+	       tracenum, names[i], h->count, latency_percentile(h, 0.5), 
+	       latency_percentile(h, 0.99), latency_percentile(h, 0.999), h->max);
+    }
+
+    qsort(slow, n, sizeof(slow_op_t), by_ticks);
+    for (i = 0; i < n; i++) {
+	op = &trace->ops[slow[i].opnum];
+	if (op->type == FREE)
+	    sprintf(msg, "%s %d", names[op->type], op->index);
+	else
+	    sprintf(msg, "%s %d %u", names[op->type], op->index, op->size);
+	printf("%14s line %-7d%-24s%10" PRIu64 " " TICKS "\n", "",
+	       LINENUM(slow[i].opnum), msg, slow[i].ticks);
+    }
+
+    free(hist);
+    free(slow);
+}
+
+/*****************************************************************
+ * The following routines replay a trace with each run of mallocs of
+ * one size made by one mm_malloc_batch, and each run of frees by
+ * one mm_free_batch.
+ ****************************************************************/
+
+/*
+ * batch_end - Return the index just past the batch starting at request
+ *     i: the run of mallocs of the same size, or of frees, that follows
+ *     it, up to BATCH_OPS requests. A realloc is a batch of its own.
+ *     The ends of the batches are found before the replay, so finding
+ *     them is not timed.
+ */
+static int batch_end(trace_t *trace, int i)
+{
+    traceop_t *op = &trace->ops[i];
+    int j = i + 1;
+
+    if (op->type == REALLOC)
+	return j;
+    while (j < trace->num_ops && j - i < BATCH_OPS && trace->ops[j].type == op->type &&
+	   (op->type == FREE || trace->ops[j].size == op->size))
+	j++;
+    return j;
+}
+
+/*
+ * eval_mm_batch_valid - Check the batched replay for correctness as
+ *     eval_mm_valid does, for every block of every batch.
+ */
+static int eval_mm_batch_valid(trace_t *trace, int tracenum, range_t **ranges, 
+			       int *ends)
+{
+    int i, j, k, index, size;
+    char *p, *ptrs[BATCH_OPS];
+
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (i = 0; i < trace->num_ops; i = j) {
+	j = ends[i];
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc_batch */
+	    if (mm_malloc_batch(size, j - i, (void **)ptrs) != j - i) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (k = i; k < j; k++) {
+		p = ptrs[k - i];
+		index = trace->ops[k].index;
+		if (p == NULL) {
+		    malloc_error(tracenum, k, "mm_malloc_batch returned NULL.");
+		    return 0;
+		}
+		if (add_range(ranges, p, size, tracenum, k) == 0)
+		    return 0;
+		memset(p, index & 0xFF, size);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+	    }
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+	    remove_range(ranges, trace->blocks[index]);
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    for (k = 0; k < size && k < trace->block_sizes[index]; k++) {
+		if (p[k] != (char)(index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE: /* mm_free_batch */
+	    for (k = i; k < j; k++) {
+		ptrs[k - i] = trace->blocks[trace->ops[k].index];
+		remove_range(ranges, ptrs[k - i]);
+	    }
+	    mm_free_batch(j - i, (void **)ptrs);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_batch_valid");
+	}
+    }
+
+    mem_reset();
+    return 1;
+}
+
+/*
+ * eval_mm_batch_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the batched replay.
+ */
+static void eval_mm_batch_speed(void *ptr)
+{
+    int i, j, k;
+    void *ptrs[BATCH_OPS];
+    traceop_t *op;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    int *ends = ((speed_t *)ptr)->ends;
+
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_batch_speed");
+
+    for (i = 0; i < trace->num_ops; i = j) {
+	j = ends[i];
+	op = &trace->ops[i];
+	switch (op->type) {
+	case ALLOC:
+	    mm_malloc_batch(op->size, j - i, ptrs);
+	    for (k = i; k < j; k++)
+		trace->blocks[trace->ops[k].index] = ptrs[k - i];
+	    break;
+	case REALLOC:
+	    if ((ptrs[0] = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+		app_error("mm_realloc error in eval_mm_batch_speed");
+	    trace->blocks[op->index] = ptrs[0];
+	    break;
+	case FREE:
+	    for (k = i; k < j; k++)
+		ptrs[k - i] = trace->blocks[trace->ops[k].index];
+	    mm_free_batch(j - i, ptrs);
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_batch_speed");
+	}
+    }
+
+    mem_reset();
+}
+
+/*
+ * print_batch_results - Check and time the batched replay of the trace,
+ *     and print the average number of requests in its malloc and free
+ *     batches with its throughput next to that of the ordinary replay.
+ */
+static void print_batch_results(trace_t *trace, int tracenum, range_t **ranges, 
+				stats_t *stats)
+{
+    int i, j, batches[3] = {0, 0, 0}, requests[3] = {0, 0, 0};
+    int *ends;
+    speed_t speed_params;
+    double kops, secs;
+
+    if ((ends = malloc(trace->num_ops * sizeof(int))) == NULL)
+	unix_error("malloc failed in print_batch_results");
+    for (i = 0; i < trace->num_ops; i = j) {
+	j = ends[i] = batch_end(trace, i);
+	batches[trace->ops[i].type]++;
+	requests[trace->ops[i].type] += j - i;
+    }
+
+    printf("%5d", tracenum);
+    if (!eval_mm_batch_valid(trace, tracenum, ranges, ends)) {
+	printf("%7s\n", "no");
+	free(ends);
+	return;
+    }
+    speed_params.trace = trace;
+    speed_params.ends = ends;
+    secs = fsecs(eval_mm_batch_speed, &speed_params);
+    free(ends);
+    kops = stats->ops / 1e3 / stats->secs;
+    printf("%7s%10.1f%10.1f%9.0f%9.0f%8.2f\n", "yes",
+	   batches[ALLOC] ? (double)requests[ALLOC] / batches[ALLOC] : 0,
+	   batches[FREE] ? (double)requests[FREE] / batches[FREE] : 0,
+	   kops, trace->num_ops / 1e3 / secs, trace->num_ops / 1e3 / secs / kops);
+}
+
+/*****************************************************************
+ * The following routines replay a trace with every free made by
+ * mm_free_sized, or with every malloc made by mm_memalign.
+ ****************************************************************/
+
+/*
+ * eval_mm_variant_valid - Check the replay for correctness as
+ *     eval_mm_valid does. With align set, every malloc is made by
+ *     mm_memalign and must be aligned to align bytes. With sized set,
+ *     every free is made by mm_free_sized with the size of the block.
+ *     Either way mm_usable_size must cover the size asked for.
+ */
+static int eval_mm_variant_valid(trace_t *trace, int tracenum, range_t **ranges, 
+				 size_t align, int sized)
+{
+    int i, j, index, size;
+    char *p;
+
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc or mm_memalign */
+	    p = align ? mm_memalign(align, size) : mm_malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, align ? "mm_memalign failed." : "mm_malloc failed.");
+		return 0;
+	    }
+	    if (align && ((uintptr_t)p & (align - 1)) != 0) {
+		malloc_error(tracenum, i, "mm_memalign returned a misaligned block.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    remove_range(ranges, trace->blocks[index]);
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    for (j = 0; j < size && j < trace->block_sizes[index]; j++) {
+		if (p[j] != (char)(index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+	    }
+	    memset(p, index & 0xFF, size);
+	    break;
+
+	case FREE: /* mm_free or mm_free_sized */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    if (sized)
+		mm_free_sized(p, trace->block_sizes[index]);
+	    else
+		mm_free(p);
+	    continue;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_variant_valid");
+	}
+
+	if (mm_usable_size(p) < size) {
+	    malloc_error(tracenum, i, "mm_usable_size is less than the size asked for.");
+	    return 0;
+	}
+	trace->blocks[index] = p;
+	trace->block_sizes[index] = size;
+    }
+
+    mem_reset();
+    return 1;
+}
+
+/*
+ * eval_mm_variant_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the replay with sized frees or
+ *    aligned mallocs. The sizes of the blocks are kept as a caller of
+ *    mm_free_sized would.
+ */
+static void eval_mm_variant_speed(void *ptr)
+{
+    int i, index, size;
+    char *p;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    size_t align = ((speed_t *)ptr)->align;
+    int sized = ((speed_t *)ptr)->sized;
+
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_variant_speed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = align ? mm_memalign(align, size) : mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_variant_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in eval_mm_variant_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    if (sized)
+		mm_free_sized(trace->blocks[index], trace->block_sizes[index]);
+	    else
+		mm_free(trace->blocks[index]);
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_variant_speed");
+	}
+    }
+
+    mem_reset();
+}
+
+/*
+ * print_variant_results - Check and time the replay of the trace with
+ *     sized frees if sized is set, and with mallocs aligned to align
+ *     bytes if align is set, and print their throughput next to that
+ *     of the ordinary replay.
+ */
+static void print_variant_results(trace_t *trace, int tracenum, range_t **ranges, 
+				  stats_t *stats, size_t align, int sized)
+{
+    speed_t speed_params;
+    double kops = stats->ops / 1e3 / stats->secs, secs;
+    int run;
+
+    printf("%5d%9.0f", tracenum, kops);
+    for (run = 0; run < 2; run++) {
+	speed_params.trace = trace;
+	speed_params.sized = run == 0;
+	speed_params.align = run == 0 ? 0 : align;
+	if ((run == 0 && !sized) || (run == 1 && !align))
+	    continue;
+	if (!eval_mm_variant_valid(trace, tracenum, ranges, speed_params.align, 
+				   speed_params.sized)) {
+	    printf("%7s%9s%8s", "no", "-", "-");
+	    continue;
+	}
+	secs = fsecs(eval_mm_variant_speed, &speed_params);
+	printf("%7s%9.0f%8.2f", "yes", stats->ops / 1e3 / secs, stats->ops / 1e3 / secs / kops);
+    }
+    printf("\n");
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -899,9 +2300,8 @@ static void eval_libc_speed(void *ptr)
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-	    if ((newp = malloc(newsize)) == NULL)
-		unix_error("malloc failed in eval_libc_speed\n");
-            free(oldp);
+	    if ((newp = realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
 	    
 	    trace->blocks[index] = newp;
 	    break;
@@ -915,6 +2315,311 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*****************************************************************
+ * The following routines count hardware events with perf_event_open
+ * while mm malloc replays a trace, to tell where its time goes.
+ ****************************************************************/
+
+/*
+ * open_counters - Open a counter for each event, disabled, for this
+ *     process. The kernel's share of each event is counted if that is
+ *     allowed (see /proc/sys/kernel/perf_event_paranoid), so the page
+ *     faults after mem_map are included. Returns the number of events
+ *     that can be counted; the others are left at -1 and printed as -.
+ */
+static int open_counters(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter_events[i].type;
+	attr.config = counter_events[i].config;
+	attr.disabled = 1;
+	attr.exclude_hv = 1;
+	attr.exclude_kernel = counters_user_only;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	counter_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counter_fds[i] < 0 && (errno == EACCES || errno == EPERM) && 
+	    !counters_user_only) {
+	    counters_user_only = 1; /* and try again for user mode alone */
+	    attr.exclude_kernel = 1;
+	    counter_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (counter_fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * eval_mm_counters - Replay the trace once with eval_mm_speed and
+ *     leave the number of each event per request in counts, or -1 for
+ *     the events that could not be counted. Counts are scaled up if
+ *     the kernel had to share the hardware counters out among events.
+ */
+static void eval_mm_counters(speed_t *speed_params, double *counts)
+{
+    struct { uint64_t value, enabled, running; } r;
+    int i;
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+	if (counter_fds[i] >= 0) {
+	    ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+
+    eval_mm_speed(speed_params);
+
+    for (i = 0; i < NUM_COUNTERS; i++) {
+	counts[i] = -1;
+	if (counter_fds[i] < 0)
+	    continue;
+	ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+	if (read(counter_fds[i], &r, sizeof(r)) == sizeof(r) && r.running > 0)
+	    counts[i] = (double)r.value * r.enabled / r.running / 
+		speed_params->trace->num_ops;
+    }
+}
+
+/*****************************************************************
+ * The following routines load other malloc packages from shared
+ * libraries (--alloc) and evaluate them for the comparison table.
+ ****************************************************************/
+
+/*
+ * load_allocator - dlopen the library at path and find its entry
+ *     points. A library that exports mm_malloc is taken to be another
+ *     mm.c, which gets its pages from the driver's memlib, so its heap
+ *     and utilization are measured just like mm malloc's. Any other
+ *     library must export malloc, free and realloc of its own.
+ */
+static allocator_t *load_allocator(char *path)
+{
+    static char *mm_names[] = {"mm_init", "mm_malloc", "mm_free", "mm_realloc"};
+    static char *libc_names[] = {"malloc", "malloc", "free", "realloc"};
+    char **names;
+    void *handle, *syms[4];
+    allocator_t *alloc;
+    struct link_map *map;
+    Dl_info info;
+    int i;
+
+    /* 
+     * The library's own definitions come first, so an mm.c in it does
+     * not bind to the driver's mm.c, while the memlib functions it
+     * does not define are found in the driver (linked with -rdynamic)
+     */
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND)) == NULL) {
+	fprintf(stderr, "Could not load %s: %s\n", path, dlerror());
+	exit(1);
+    }
+    dlinfo(handle, RTLD_DI_LINKMAP, &map);
+
+    names = dlsym(handle, "mm_malloc") ? mm_names : libc_names;
+    for (i = 0; i < 4; i++) {
+	syms[i] = dlsym(handle, names[i]);
+	/* dlsym also searches the libraries it depends on, such as libc */
+	if (syms[i] == NULL || !dladdr(syms[i], &info) ||
+	    strcmp(info.dli_fname, map->l_name) != 0) {
+	    fprintf(stderr, "%s does not define %s\n", path, names[i]);
+	    exit(1);
+	}
+    }
+
+    if ((alloc = (allocator_t *)calloc(1, sizeof(allocator_t))) == NULL)
+	unix_error("calloc failed in load_allocator");
+    alloc->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (names == mm_names) {
+	alloc->init = (int (*)(void))syms[0];
+	alloc->reset = mem_reset;
+	alloc->memlib = 1;
+    }
+    alloc->malloc = (void *(*)(size_t))syms[1];
+    alloc->free = (void (*)(void *))syms[2];
+    alloc->realloc = (void *(*)(void *, size_t))syms[3];
+    return alloc;
+}
+
+/*
+ * eval_alloc_valid - Check that the malloc package can run the trace
+ *     to completion with every payload aligned, and that no payload is
+ *     overwritten while it is allocated: the first and last byte of
+ *     each one are tagged and checked when it is freed or reallocated.
+ */
+static int eval_alloc_valid(trace_t *trace, int tracenum, allocator_t *alloc)
+{
+    int i, index, size, valid = 1;
+    char *p, *oldp;
+
+    if (alloc->init != NULL && alloc->init() < 0) {
+	malloc_error(tracenum, 0, "init failed.");
+	return 0;
+    }
+
+    for (i = 0;  i < trace->num_ops && valid;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	case REALLOC: /* realloc */
+	    if (trace->ops[i].type == REALLOC) {
+		oldp = trace->blocks[index];
+		if (oldp[0] != (char)(index & 0xFF) ||
+		    oldp[trace->block_sizes[index]-1] != (char)(index & 0xFF)) {
+		    malloc_error(tracenum, i, "block was overwritten before realloc");
+		    valid = 0;
+		    break;
+		}
+		p = alloc->realloc(oldp, size);
+	    }
+	    else
+		p = alloc->malloc(size);
+	    if (p == NULL) {
+		malloc_error(tracenum, i, "malloc failed.");
+		valid = 0;
+		break;
+	    }
+	    if (!IS_ALIGNED(p)) {
+		malloc_error(tracenum, i, "Payload address is not aligned");
+		valid = 0;
+		break;
+	    }
+	    if (trace->ops[i].type == REALLOC && p[0] != (char)(index & 0xFF)) {
+		malloc_error(tracenum, i, "realloc did not preserve the data from old block");
+		valid = 0;
+		break;
+	    }
+	    p[0] = p[size-1] = index & 0xFF;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* free */
+            p = trace->blocks[index];
+	    if (p[0] != (char)(index & 0xFF) ||
+		p[trace->block_sizes[index]-1] != (char)(index & 0xFF)) {
+		malloc_error(tracenum, i, "block was overwritten before free");
+		valid = 0;
+		break;
+	    }
+            alloc->free(p);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_alloc_valid");
+        }
+    }
+
+    if (alloc->reset != NULL)
+	alloc->reset();
+    return valid;
+}
+
+/*
+ * eval_alloc_util - Evaluate the peak and the average instantaneous
+ *     utilization of a malloc package that gets its pages from memlib,
+ *     as eval_mm_util does for mm malloc
+ */
+static double eval_alloc_util(trace_t *trace, allocator_t *alloc, stats_t *stats)
+{
+    int i, index, size;
+    size_t total_size = 0, max_total_size = 0, heap_size, max_heap_size = 0;
+    double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
+    int ratio_exp;
+
+    if (alloc->init() < 0)
+	app_error("init failed in eval_alloc_util");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((trace->blocks[index] = alloc->malloc(size)) == NULL)
+		app_error("malloc failed in eval_alloc_util");
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+            break;
+
+	case REALLOC: /* realloc */
+	    if ((trace->blocks[index] = alloc->realloc(trace->blocks[index], size)) == NULL)
+		app_error("realloc failed in eval_alloc_util");
+	    total_size += size - trace->block_sizes[index];
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* free */
+	    alloc->free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_alloc_util");
+        }
+
+	max_total_size = (total_size > max_total_size) ? total_size : max_total_size;
+	heap_size = mem_heapsize();
+	max_heap_size = (heap_size > max_heap_size) ? heap_size : max_heap_size;
+
+        ratio = (double)(total_size + 1) / (heap_size + 1);
+        ratio_frac = frexp(ratio, &ratio_exp);
+        accum_ratio_frac *= ratio_frac;
+        accum_ratio_exp += ratio_exp;
+        accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
+        accum_ratio_exp += ratio_exp;
+    }
+
+    alloc->reset();
+
+    stats->inst_util = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
+    return (double)max_total_size / max_heap_size;
+}
+
+/* 
+ * eval_alloc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of a loaded malloc package on the trace.
+ */
+static void eval_alloc_speed(void *ptr)
+{
+    int i, index;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    allocator_t *alloc = ((speed_t *)ptr)->alloc;
+
+    if (alloc->init != NULL && alloc->init() < 0)
+	app_error("init failed in eval_alloc_speed");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    if ((trace->blocks[index] = alloc->malloc(trace->ops[i].size)) == NULL)
+		app_error("malloc failed in eval_alloc_speed");
+	    break;
+
+	case REALLOC: /* realloc */
+	    if ((trace->blocks[index] = 
+		 alloc->realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("realloc failed in eval_alloc_speed");
+	    break;
+	    
+        case FREE: /* free */
+	    alloc->free(trace->blocks[index]);
+	    break;
+	}
+    }
+
+    if (alloc->reset != NULL)
+	alloc->reset();
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -982,6 +2687,164 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printreallocs - prints how many realloc requests of each trace were
+ *     resized in place, each of which avoided a copy
+ */
+static void printreallocs(int n, stats_t *stats)
+{
+    int i;
+
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].reallocs > 0)
+	    printf("trace %d: %d of %d reallocs resized in place (%.0f%% of copies avoided)\n",
+		   i, stats[i].inplace, stats[i].reallocs,
+		   100.0 * stats[i].inplace / stats[i].reallocs);
+    }
+}
+
+/*
+ * printreserved - prints the utilization of each trace against the
+ *     committed heap and against the reserved heap, which differ when
+ *     the allocator decommits pages it keeps mapped
+ */
+static void printreserved(int n, stats_t *stats)
+{
+    int i;
+
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].reserved_util < stats[i].util)
+	    printf("trace %d: %.0f%% util of committed heap, %.0f%% of reserved heap\n",
+		   i, 100.0 * stats[i].util, 100.0 * stats[i].reserved_util);
+    }
+}
+
+/*
+ * printhugepages - prints how much of the heap of each trace was backed
+ *     by huge pages, if they were turned on with -H
+ */
+static void printhugepages(int n, stats_t *stats)
+{
+    int i;
+
+    if (!mem_hugepages())
+	return;
+    for (i=0; i < n; i++) {
+	if (stats[i].valid)
+	    printf("trace %d: %.1f MB of heap backed by huge pages%s\n",
+		   i, stats[i].huge_bytes / (1024.0 * 1024.0),
+		   stats[i].huge_bytes ? "" : " (none granted)");
+    }
+}
+
+/*
+ * printheapstats - prints the statistics of the heap of each trace when
+ *     it was largest, and the counters for the whole trace
+ */
+static void printheapstats(int n, stats_t *stats)
+{
+    int i, j;
+
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	printf("trace %d: peak %zu KB in use, %zu KB free in %zu blocks, %zu KB retained\n",
+	       i, stats[i].heap.in_use / 1024, stats[i].heap.free / 1024,
+	       stats[i].heap.free_blocks, stats[i].heap.retained / 1024);
+	printf("         longest scan %zu, %zu splits, %zu coalesces, %zu maps, %zu unmaps\n",
+	       stats[i].heap.longest_scan, stats[i].heap.splits, stats[i].heap.coalesces,
+	       stats[i].heap.maps, stats[i].heap.unmaps);
+	printf("         free blocks by size:");
+	for (j=0; j < MM_STATS_BUCKETS; j++) {
+	    if (stats[i].heap.free_histogram[j] > 0)
+		printf(" %lu%s:%zu", 32UL << j, j == MM_STATS_BUCKETS - 1 ? "+" : "",
+		       stats[i].heap.free_histogram[j]);
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printcounters - prints the hardware events per request counted by
+ *     eval_mm_counters for each trace
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, j;
+    double *c;
+
+    printf("%5s%7s", "trace", "IPC");
+    for (j = 0; j < NUM_COUNTERS; j++)
+	printf("%10s", counter_events[j].name);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	c = stats[i].counters;
+	if (c[0] > 0 && c[1] >= 0)
+	    printf("%5d%7.2f", i, c[1] / c[0]);
+	else
+	    printf("%5d%7s", i, "-");
+	for (j = 0; j < NUM_COUNTERS; j++) {
+	    if (c[j] < 0)
+		printf("%10s", "-");
+	    else
+		printf("%10.2f", c[j]);
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printcomparison - prints the utilization and throughput of each of
+ *     the n malloc packages in allocs side by side, one trace per line
+ */
+static void printcomparison(int ntraces, int n, allocator_t **allocs, stats_t **stats)
+{
+    int i, a;
+    double util, secs, ops;
+
+    printf("%5s", "trace");
+    for (a = 0; a < n; a++)
+	printf("%18.17s", allocs[a]->name);
+    printf("\n%5s", "");
+    for (a = 0; a < n; a++)
+	printf("%8s%10s", "util", "Kops");
+    printf("\n");
+
+    for (i = 0; i < ntraces; i++) {
+	printf("%5d", i);
+	for (a = 0; a < n; a++) {
+	    if (!stats[a][i].valid)
+		printf("%8s%10s", "-", "-");
+	    else if (!allocs[a]->memlib)
+		printf("%8s%10.0f", "-", stats[a][i].ops / 1e3 / stats[a][i].secs);
+	    else
+		printf("%7.0f%%%10.0f", stats[a][i].util * 100.0, 
+		       stats[a][i].ops / 1e3 / stats[a][i].secs);
+	}
+	printf("\n");
+    }
+
+    /* The average utilization and the throughput over all traces */
+    printf("%5s", "Total");
+    for (a = 0; a < n; a++) {
+	util = secs = ops = 0;
+	for (i = 0; i < ntraces && stats[a][i].valid; i++) {
+	    util += stats[a][i].util;
+	    secs += stats[a][i].secs;
+	    ops += stats[a][i].ops;
+	}
+	if (i < ntraces)
+	    printf("%8s%10s", "-", "-");
+	else if (!allocs[a]->memlib)
+	    printf("%8s%10.0f", "-", ops / 1e3 / secs);
+	else
+	    printf("%7.0f%%%10.0f", util / ntraces * 100.0, ops / 1e3 / secs);
+    }
+    printf("\n");
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1014,13 +2877,35 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVglHDPBS] [-f <file>] [-t <dir>] [-T <n>] [-M <mode>] [-L <n>]\n"
+	    "               [-a <align>] [-G <min>,<max>] [--alloc <lib.so>]...\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t--alloc <lib.so>, -A <lib.so>\n");
+    fprintf(stderr, "\t           Also evaluate the malloc package in <lib.so>, which exports\n");
+    fprintf(stderr, "\t           mm_init, mm_malloc, mm_free and mm_realloc, or else malloc,\n");
+    fprintf(stderr, "\t           free and realloc. Can be given more than once.\n");
+    fprintf(stderr, "\t-a <align> Also replay each trace with every malloc made by mm_memalign\n");
+    fprintf(stderr, "\t           with an alignment of <align> bytes, a power of 2.\n");
+    fprintf(stderr, "\t-B         Also replay each trace with each run of mallocs of one size\n");
+    fprintf(stderr, "\t           made by mm_malloc_batch, and each run of frees by\n");
+    fprintf(stderr, "\t           mm_free_batch.\n");
+    fprintf(stderr, "\t-D         Decommit the idle pages of large free blocks.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G <min>,<max>\n");
+    fprintf(stderr, "\t           Grow the heap by chunks of <min> to <max> pages.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Map large heap regions with transparent huge pages.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L <n>     Time each request, list the <n> slowest of each trace.\n");
+    fprintf(stderr, "\t-S         Also replay each trace with every free made by mm_free_sized.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-P         Count cycles, cache, TLB and branch misses, and page\n");
+    fprintf(stderr, "\t           faults per request with perf_event_open.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace on 1 to <n> threads at once.\n");
+    fprintf(stderr, "\t-M <mode>  With -T, each thread replays a copy of the trace (copies),\n");
+    fprintf(stderr, "\t           a range of its ids (split), or threads in pairs pass\n");
+    fprintf(stderr, "\t           the blocks to free from one to the other (handoff).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
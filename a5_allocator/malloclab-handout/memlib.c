@@ -17,6 +17,8 @@
 static int activity_counter = 0; /* to simulate other processes */
 
 static int page_count;
+static int decommitted_count; /* mapped pages given back by mem_decommit */
+static int use_hugepages;     /* set by mem_set_hugepages */
 
 /* 
  * mem_init - initialize the memory system model
@@ -31,13 +33,33 @@ void mem_init(void)
   }
 }
 
-static void unmap(void *p)
+/* the run of contiguous pages that unmap has yet to unmap */
+static void *run_start;
+static size_t run_size;
+
+static void unmap_run(void)
 {
-  if (munmap(p, APAGE_SIZE) < 0) {
+  if (run_size > 0 && munmap(run_start, run_size) < 0) {
     fprintf(stderr, "unexpected error in munmap: %s (%d)\n",
             strerror(errno), errno);
     abort();
   }
+  run_size = 0;
+}
+
+/* pages come in the reverse of the order they were mapped, so a
+   mapping is a run of pages with falling addresses; each run is
+   unmapped at once instead of page by page */
+static void unmap(void *p)
+{
+  if (run_size > 0 && p + APAGE_SIZE == run_start) {
+    run_start = p;
+    run_size += APAGE_SIZE;
+    return;
+  }
+  unmap_run();
+  run_start = p;
+  run_size = APAGE_SIZE;
 }
 
 /* 
@@ -46,7 +68,9 @@ static void unmap(void *p)
 void mem_reset(void)
 {
   pagemap_for_each(unmap);
+  unmap_run();
   page_count = 0;
+  decommitted_count = 0;
   activity_counter = 0;
 }
 
@@ -58,11 +82,98 @@ size_t mem_pagesize()
   return APAGE_SIZE;
 }
 
+/*
+ * mem_heapsize() - returns the number of bytes that are mapped and
+ *    committed, which does not count decommitted pages
+ */
 size_t mem_heapsize(void)
+{
+  return APAGE_SIZE * (page_count - decommitted_count);
+}
+
+/*
+ * mem_reservedsize() - returns the number of bytes that are mapped,
+ *    whether they are committed or not
+ */
+size_t mem_reservedsize(void)
 {
   return APAGE_SIZE * page_count;
 }
 
+/*
+ * mem_set_hugepages - turns transparent huge pages on or off for later
+ *    mem_map calls of at least HPAGE_SIZE bytes
+ */
+void mem_set_hugepages(int on)
+{
+  use_hugepages = on;
+}
+
+/*
+ * mem_hugepages - returns whether huge pages were turned on
+ */
+int mem_hugepages(void)
+{
+  return use_hugepages;
+}
+
+/*
+ * mem_hugepage_bytes - returns the number of bytes of the mappings that
+ *    hold mapped pages which the system backs with huge pages, as
+ *    reported by /proc/self/smaps, or 0 if that cannot be read
+ */
+size_t mem_hugepage_bytes(void)
+{
+  FILE *f;
+  char line[256];
+  unsigned long lo, hi, kb;
+  int ours = 0;
+  size_t total = 0;
+
+  if ((f = fopen("/proc/self/smaps", "r")) == NULL)
+    return 0;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+      /* a new mapping; check whether any of its pages are ours */
+      for (ours = 0; !ours && lo < hi; lo += APAGE_SIZE)
+        ours = pagemap_is_mapped((void *)lo);
+    } else if (ours && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+      total += kb * 1024;
+    }
+  }
+
+  fclose(f);
+  return total;
+}
+
+/*
+ * map_aligned - maps sz bytes aligned to HPAGE_SIZE by mapping more
+ *    than needed and unmapping the excess on either side
+ */
+static void *map_aligned(size_t sz)
+{
+  void *p, *aligned;
+  size_t head, tail;
+
+  p = mmap(0, sz + HPAGE_SIZE - APAGE_SIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (p == MAP_FAILED)
+    return p;
+
+  aligned = (void *)(((uintptr_t)p + HPAGE_SIZE - 1) & ~((uintptr_t)HPAGE_SIZE - 1));
+  head = aligned - p;
+  tail = HPAGE_SIZE - APAGE_SIZE - head;
+  if (head > 0)
+    munmap(p, head);
+  if (tail > 0)
+    munmap(aligned + sz, tail);
+
+  /* only a hint; the system may still back the mapping with small pages */
+  madvise(aligned, sz, MADV_HUGEPAGE);
+
+  return aligned;
+}
 
 void *mem_map(size_t sz)
 {
@@ -82,12 +193,13 @@ void *mem_map(size_t sz)
     mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
   }
 
-  p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (p == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %s (%d)\n",
-            strerror(errno), errno);
-    abort();
-  }
+  if (use_hugepages && sz >= HPAGE_SIZE)
+    p = map_aligned(sz);
+  else
+    p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  /* out of memory is the caller's to handle, errno is left as mmap set it */
+  if (p == MAP_FAILED)
+    return NULL;
 
   for (i = 0; i < sz; i += APAGE_SIZE) {
     pagemap_modify(p + i, 1);
@@ -120,6 +232,8 @@ void mem_unmap(void *p, size_t sz)
       abort();
     }      
 
+    if (pagemap_is_decommitted(p + i))
+      --decommitted_count;
     pagemap_modify(p + i, 0);
     
     --page_count;
@@ -131,3 +245,74 @@ void mem_unmap(void *p, size_t sz)
     abort();
   }
 }
+
+static void check_range(const char *who, void *p, size_t sz)
+{
+  size_t i;
+
+  if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "%s: given address is not page-aligned: %p\n",
+            who, p);
+    abort();
+  }
+
+  if (sz & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "%s: given size is not a multiple of %d: %ld\n",
+            who, APAGE_SIZE, sz);
+    abort();
+  }
+
+  for (i = 0; i < sz; i += APAGE_SIZE) {
+    if (!pagemap_is_mapped(p+i)) {
+      fprintf(stderr, "%s: given page is not mapped: %p (in %p:%p)\n",
+              who, p + i, p, p + sz);
+      abort();
+    }
+  }
+}
+
+/*
+ * mem_decommit - gives the memory of mapped pages back to the system
+ *    with madvise, while keeping them mapped; their contents are lost
+ *    and they read as zero when touched again
+ */
+void mem_decommit(void *p, size_t sz)
+{
+  size_t i, start;
+
+  check_range("mem_decommit", p, sz);
+
+  /* madvise each run of pages that are still committed */
+  for (i = 0; i < sz; i = start) {
+    while (i < sz && pagemap_is_decommitted(p + i))
+      i += APAGE_SIZE;
+    for (start = i; start < sz && !pagemap_is_decommitted(p + start); start += APAGE_SIZE) {
+      pagemap_set_decommitted(p + start, 1);
+      decommitted_count++;
+    }
+    if (start > i && madvise(p + i, start - i, MADV_DONTNEED) < 0) {
+      fprintf(stderr, "madvise failed: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+  }
+}
+
+/*
+ * mem_commit - marks decommitted pages as committed again before they
+ *    are reused; this only updates the accounting, as the system gives
+ *    the memory back on the first touch
+ */
+void mem_commit(void *p, size_t sz)
+{
+  size_t i;
+
+  check_range("mem_commit", p, sz);
+
+  for (i = 0; i < sz; i += APAGE_SIZE) {
+    if (pagemap_is_decommitted(p + i)) {
+      pagemap_set_decommitted(p + i, 0);
+      decommitted_count--;
+    }
+  }
+}
@@ -1,10 +1,20 @@
 #include <unistd.h>
 
+/* Size and alignment of mappings that may use transparent huge pages */
+#define HPAGE_SIZE (2 * 1024 * 1024)
+
 void mem_init(void);               
 void mem_reset(void);
 
 size_t mem_pagesize(void);
 void *mem_map(size_t);
 void mem_unmap(void *, size_t);
+void mem_decommit(void *, size_t);
+void mem_commit(void *, size_t);
 
 size_t mem_heapsize(void);
+size_t mem_reservedsize(void);
+
+void mem_set_hugepages(int);
+int mem_hugepages(void);
+size_t mem_hugepage_bytes(void);
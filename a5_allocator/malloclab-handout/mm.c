@@ -7,6 +7,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -14,6 +16,19 @@
 /* Predefined variable for heap checking, if set to any number other then 0 the heap checker will be used */
 #define DEBUG 0
 
+/* Predefined variable for statistics, if set to 0 the counters behind mm_stats are compiled out and read as 0 */
+#define STATS 1
+
+/* Add n to a counter of heap_stats, the heap lock must be held */
+#if STATS
+#define STAT_ADD(field, n) (heap_stats.field += (n))
+#else
+#define STAT_ADD(field, n) ((void)0)
+#endif
+
+/* Add n to the bytes of allocated heap blocks, which the growth policy needs even when STATS is 0, the heap lock must be held */
+#define LIVE_ADD(n) (heap_live += (n), STAT_ADD(in_use, (n)))
+
 /* always use 16-byte alignment */
 #define ALIGNMENT 16
 
@@ -23,17 +38,131 @@
 /* rounds up to the nearest multiple of mem_pagesize() */
 #define PAGE_ALIGN(size) (((size) + (mem_pagesize()-1)) & ~(mem_pagesize()-1))
 
+/* requests of more bytes fail, so rounding a size up, even with an alignment and headers added, can never overflow */
+#define MAX_REQUEST (SIZE_MAX / 4)
+
+/* 
+ * Number of segregated free lists.
+ * Class i holds free blocks of [32*2^i, 32*2^(i+1)) bytes, counting their header.
+ * Free blocks of TREE_THRESHOLD bytes or more are kept in the best fit tree, which is treated as class TREE_CLASS.
+ */
+#define NUM_CLASSES 5
+#define TREE_CLASS NUM_CLASSES
+#define TREE_THRESHOLD (32 << NUM_CLASSES)
+
+/* 
+ * Thread cache sizes.
+ * Blocks with a payload of up to CACHE_MAX bytes are cached per thread.
+ * A bin is refilled with CACHE_BATCH blocks at a time, and when it holds CACHE_LIMIT blocks CACHE_BATCH of them are returned to the heap.
+ */
+#define CACHE_MAX 256
+#define CACHE_BINS (CACHE_MAX / ALIGNMENT)
+#define CACHE_BATCH 8
+#define CACHE_LIMIT 32
+
+/* 
+ * Slab sizes.
+ * Blocks with a payload of up to SLAB_MAX bytes are taken from slabs, which are single pages holding objects of one size.
+ * SLAB_WORDS is the number of bitmap words needed for a page of the smallest objects.
+ * SLAB_TABLE_SIZE is the number of entries in the table used to look up slab pages, it must be a power of 2.
+ * Slab pages are mapped SLAB_BATCH at a time, and the pages not yet used are released to the region cache for the next slabs.
+ */
+#define SLAB_MAX 128
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+#define SLAB_WORDS (4096 / ALIGNMENT / 64)
+#define SLAB_TABLE_SIZE (1 << 16)
+#define SLAB_BATCH 16
+
+/* 
+ * Blocks with a payload of more than HUGE_THRESHOLD bytes are not taken from the heap.
+ * Each one gets its own mapping from mem_map, which is unallocated again as soon as the block is freed.
+ */
+#define HUGE_THRESHOLD (64 * 1024)
+
+/* 
+ * Region cache sizes.
+ * Released regions of up to RETAIN_BUCKETS pages are kept mapped in a list per page count, to be reused by later growth of the heap or by slabs.
+ * At most RETAIN_MAX pages are kept, and only as long as the pages in use and the retained pages together stay within the high-water mark of the heap.
+ * A region that has not been reused within RETAIN_AGE releases or reuses is unallocated.
+ */
+#define RETAIN_BUCKETS 128
+#define RETAIN_MAX 1024
+#define RETAIN_AGE 256
+
+/* 
+ * If mm_set_decommit has turned it on, free blocks in the tree whose interior covers at least DECOMMIT_MIN whole pages have those pages decommitted.
+ * The pages stay mapped, so the block can be used again without mapping it, but they no longer take up memory.
+ * Such blocks wait on the idle list, oldest first, and each time DECOMMIT_PERIOD pages worth of tree blocks have been freed a pass decommits those that were already on it at the pass before.
+ */
+#define DECOMMIT_MIN 16
+#define DECOMMIT_PERIOD 1024
+
+/* 
+ * Arena sizes.
+ * Arenas bump their objects out of chunks of ARENA_CHUNK bytes, an object too large for one gets a chunk of its own.
+ * Up to ARENA_CACHE chunks of ARENA_CHUNK bytes given back by arenas are kept committed for the next arena, the rest go to the region cache.
+ */
+#define ARENA_CHUNK (16 * 4096)
+#define ARENA_CACHE 16
+
+/* 
+ * Quick list sizes.
+ * Freed heap blocks of up to QUICK_MAX bytes, counting their header, are pushed onto a LIFO quick list per size instead of being coalesced.
+ * When a quick list holds more than QUICK_LIMIT blocks they are all coalesced, and all quick lists are coalesced before the heap grows.
+ */
+#define QUICK_MAX 512
+#define QUICK_BINS (QUICK_MAX / ALIGNMENT - 1)
+#define QUICK_LIMIT 8
+
+/* Batches of freed heap blocks with up to SORT_MIN blocks are sorted by insertion, larger ones with qsort */
+#define SORT_MIN 32
+
+/* 
+ * Heap growth.
+ * The heap grows by a chunk of GROWTH_MIN to GROWTH_MAX pages, unless mm_set_growth has changed these bounds.
+ * GROWTH_MAX is kept within RETAIN_BUCKETS, so that the region cache keeps the regions of a heap that shrinks and grows again.
+ * Only the pages of a chunk that are used are committed, so a large chunk costs address space rather than memory.
+ * A chunk used up by fewer than GROWTH_FAST heap block allocations doubles for the next growth, and one that lasted for more than GROWTH_SLOW halves.
+ */
+#define GROWTH_MIN 1
+#define GROWTH_MAX 64
+#define GROWTH_FAST 64
+#define GROWTH_SLOW 4096
+
+/* 
+ * With huge pages on, heaps of at least this many bytes grow by whole huge pages.
+ * Smaller heaps keep growing by chunks within the growth bounds, as an unused huge page would cost them too much utilization.
+ */
+#define HUGE_GROWTH_MIN (8 * HPAGE_SIZE)
+
 /* 
  * Header structure for each block. 
  * The sizeForward field contains the amount of bytes to traverse from the current byte to the next header.
- * The sizeReverse field contains the amount of bytes to traverse from the current byte to the previous header.
- * The last 4 bits of sizeForward are used to indicate if the block is allocated or not.
+ * The last 4 bits of sizeForward are used to indicate if the block is allocated, if the previous block is allocated, if the block is a sentinel, and if the block is on a quick list.
+ * Free blocks also end with a footer holding their size, so the header of a free previous block can be found.
+ * Allocated blocks have no footer, their payload runs up to the next header.
+ * 
+ * Every mapping starts with a region word holding its size, followed by the sentinel block and ending with a terminator header of size 0.
+ * The sentinel counts its previous block as allocated, and the terminator counts as allocated itself, so neither is ever coalesced past.
+ * A huge block is the sentinel of its own mapping, which is marked by setting HUGE in the region word.
+ * A block on a quick list has been freed but not coalesced, it keeps ALLOC set so its neighbours are not coalesced with it either.
  */
 struct header {
   size_t sizeForward;
-  size_t sizeReverse;
 };
 
+/* Bits of sizeForward */
+#define ALLOC 0x1
+#define PREV_ALLOC 0x2
+#define SENTINEL 0x4
+#define QUICK 0x8
+
+/* Bits of the region word */
+#define HUGE 0x1
+
+/* The smallest block is a header, a free node and a footer */
+#define MIN_BLOCK 32
+
 /* 
  * Free list node structure. 
  * The free list is a doubly linked list of free blocks.
@@ -47,15 +176,120 @@ struct free_node {
 /* Given a payload pointer get the header pointer */
 #define GET_HEADER(p) ((struct header*)((void*)(p) - sizeof(struct header)))
 
-/* Given a header pointer do the stated operation */
-#define GET_SIZE(h) ((size_t)((void*)(((struct header*)(h))->sizeForward & ~0xF) - sizeof(struct header)))
-#define GET_NEXT(h) ((void*)(h) + (((struct header*)(h))->sizeForward & ~0xF))
-#define GET_PREV(h) ((void*)(h) - ((struct header*)(h))->sizeReverse) 
-#define GET_ALLOC(h) (((struct header*)(h))->sizeForward & 0x1)
-#define SET_ALLOC(h, alloc) (((struct header*)(h))->sizeForward = (((struct header*)h)->sizeForward & ~0xF) | (alloc & 0x1))
+/* 
+ * Tree node structure.
+ * Free blocks of at least TREE_THRESHOLD bytes are kept in a treap instead of a free list.
+ * The treap is ordered by size and then by address, and its heap priority is a hash of the node address.
+ * The left and right fields point to the children of the node, and are stored in the payload in place of the free_node.
+ * The decommitted field is set when whole pages in the interior of the block, past this node and before the footer, may be decommitted, and those pages are committed before the block is used.
+ * The idle field is set while the block is on the idle list, linked by idle_prev and idle_next, and idle_pass is the decommit pass it was added after.
+ */
+struct tree_node {
+  struct tree_node *left;
+  struct tree_node *right;
+  struct tree_node *idle_prev;
+  struct tree_node *idle_next;
+  unsigned long idle_pass;
+  int decommitted;
+  int idle;
+};
+
+/* 
+ * Thread cache structure.
+ * Each thread keeps LIFO lists of freed blocks with a payload of up to CACHE_MAX bytes, one list per multiple of 16.
+ * Cached blocks stay allocated in the heap, so they are handed out and taken back without taking the heap lock.
+ * The generation field records which heap the blocks came from, mm_init starts a new heap and the old blocks are dropped.
+ */
+struct thread_cache {
+  struct free_node *bins[CACHE_BINS];
+  int counts[CACHE_BINS];
+  unsigned long generation;
+};
+
+/* 
+ * Slab structure.
+ * Each slab is a page from mem_map that starts with this structure, followed by capacity objects of the same size.
+ * The objects have no header, bit i of the bitmap is set when object i is allocated.
+ * Slabs with free objects are kept in a doubly linked list per size, full slabs are not in any list.
+ */
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  size_t size;
+  int used;
+  int capacity;
+  unsigned long bitmap[SLAB_WORDS];
+};
+
+/* 
+ * Slab table entry structure.
+ * The slab table is an open addressing hash table of every slab page, used to tell slab objects from heap blocks.
+ * An entry is only valid if its generation is the current heap generation, so mm_init does not need to clear the table.
+ */
+struct slab_entry {
+  struct slab *page;
+  unsigned long generation;
+};
+
+/* 
+ * Retained region structure.
+ * A released region is kept mapped with this structure at its start, in place of its region word.
+ * The next and prev fields link the bucket of its page count, and newer and older link every retained region in the order they were released.
+ * The stamp field records the value of the region clock when the region was released.
+ */
+struct retained_region {
+  size_t size;
+  struct retained_region *next;
+  struct retained_region *prev;
+  struct retained_region *newer;
+  struct retained_region *older;
+  unsigned long stamp;
+};
+
+/* 
+ * Arena chunk structure.
+ * Each chunk is a region from map_region that starts with this structure, followed by the objects bumped out of it.
+ * The chunks of an arena are kept in a list, the chunk being bumped first.
+ * Chunks in the arena chunk cache are linked through the same next field.
+ */
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+};
+
+/* 
+ * Arena structure, the struct mm_arena of mm.h.
+ * It is kept in its first chunk, right after the chunk structure.
+ * Objects are bumped from next up to end in the first chunk of the list, they have no header and are only freed all at once.
+ */
+struct mm_arena {
+  struct arena_chunk *chunks;
+  void *next;
+  void *end;
+};
+
+/* Given a payload size get the size of the block needed to hold it */
+#define GET_BLOCK_SIZE(size) ((size) + sizeof(struct header) <= MIN_BLOCK ? MIN_BLOCK : ALIGN((size) + sizeof(struct header)))
+
+/* 
+ * Given a header pointer do the stated operation.
+ * GET_PREV is only valid if the previous block is free, and GET_REGION only if the block is a sentinel.
+ */
+#define GET_BLOCK(h) (((struct header*)(h))->sizeForward & ~0xF)
+#define GET_SIZE(h) (GET_BLOCK(h) - sizeof(struct header))
+#define GET_NEXT(h) ((void*)(h) + GET_BLOCK(h))
+#define GET_FOOTER(h) ((size_t*)GET_NEXT(h) - 1)
+#define GET_PREV(h) ((void*)(h) - *((size_t*)(h) - 1))
+#define GET_REGION(h) ((size_t*)(h) - 1)
+#define GET_ALLOC(h) (((struct header*)(h))->sizeForward & ALLOC)
+#define GET_PREV_ALLOC(h) (((struct header*)(h))->sizeForward & PREV_ALLOC)
+#define GET_PREV_BITS(h) (((struct header*)(h))->sizeForward & (PREV_ALLOC | SENTINEL))
+#define SET_PREV_ALLOC(h, alloc) (((struct header*)(h))->sizeForward = (((struct header*)(h))->sizeForward & ~PREV_ALLOC) | ((alloc) ? PREV_ALLOC : 0))
 #define GET_PAYLOAD(h) ((void*)((void*)(h) + sizeof(struct header)))
-#define IS_TERMINATOR(h) (((struct header*)(h))->sizeForward == 0)
-#define IS_SENTINEL(h) (((struct header*)(h))->sizeReverse == 0)
+#define IS_TERMINATOR(h) (GET_BLOCK(h) == 0)
+#define IS_SENTINEL(h) (((struct header*)(h))->sizeForward & SENTINEL)
+#define IS_HUGE(h) (IS_SENTINEL(h) && (*GET_REGION(h) & HUGE))
+#define IS_QUICK(h) (((struct header*)(h))->sizeForward & QUICK)
 
 /* Given a free_node pointer do the stated operation */
 #define GET_PREV_FREE(f) (((struct free_node*)(f))->prev)
@@ -63,22 +297,197 @@ struct free_node {
 #define IS_FIRST_FREE(f) (((struct free_node*)(f))->prev == NULL)
 #define IS_LAST_FREE(f) (((struct free_node*)(f))->next == NULL)
 
+/* Given a block size get the index of the segregated free list it belongs to, or TREE_CLASS for the tree */
+#define LOG2(x) (63 - __builtin_clzl((x) | 1))
+#define GET_CLASS(size) ((size) >= TREE_THRESHOLD ? TREE_CLASS : LOG2((size) >> 5))
+
+/* Given a payload size of at most CACHE_MAX get the index of its thread cache bin */
+#define GET_BIN(size) ((size) / ALIGNMENT - 1)
+
+/* Given a block size of at most QUICK_MAX get the index of its quick list */
+#define GET_QUICK_BIN(size) ((size) / ALIGNMENT - 2)
+
+/* Given a payload pointer or a payload size of at most SLAB_MAX do the stated operation */
+#define GET_SLAB_PAGE(p) ((struct slab*)((uintptr_t)(p) & ~(uintptr_t)(mem_pagesize()-1)))
+#define GET_SLAB_HASH(page) ((((uintptr_t)(page) >> 12) * 0x9E3779B97F4A7C15UL) >> 48)
+#define GET_SLAB_CLASS(size) ((size) / ALIGNMENT - 1)
+#define GET_SLAB_OBJECTS(s) ((void*)(s) + ALIGN(sizeof(struct slab)))
+
+/* 
+ * Given a header pointer and a power of 2 alignment, get the distance to the first header after it whose payload is aligned and leaves room for a free block before it.
+ * If the payload of the block itself is aligned the distance is 0.
+ */
+#define GET_ALIGN_LEAD(h, align) (((uintptr_t)GET_PAYLOAD(h) & ((align) - 1)) == 0 ? 0 : \
+  ((((uintptr_t)GET_PAYLOAD(h) + MIN_BLOCK + (align) - 1) & ~(uintptr_t)((align) - 1)) - (uintptr_t)GET_PAYLOAD(h)))
+
+/* 
+ * Given a header pointer of a free block, or of where one will be, get the bounds of its interior.
+ * The interior is the whole pages after the tree node and before the footer, which hold no data while the block is free.
+ */
+#define GET_INTERIOR_START(h) ((void*)PAGE_ALIGN((uintptr_t)GET_PAYLOAD(h) + sizeof(struct tree_node)))
+#define GET_INTERIOR_END(h) ((void*)((uintptr_t)GET_FOOTER(h) & ~(uintptr_t)(mem_pagesize()-1)))
+#define IS_DECOMMITTED(h) (GET_BLOCK(h) >= TREE_THRESHOLD && ((struct tree_node*)GET_PAYLOAD(h))->decommitted)
+
+/* Given a tree_node pointer do the stated operation */
+#define GET_PRIORITY(t) (((uintptr_t)(t) * 0x9E3779B97F4A7C15UL) >> 32)
+#define GET_KEY(t) GET_BLOCK(GET_HEADER(t))
+#define TREE_LESS(a, b) (GET_KEY(a) < GET_KEY(b) || (GET_KEY(a) == GET_KEY(b) && (void*)(a) < (void*)(b)))
+
 /* Helper Functions */
-void pack_header(struct header *h, size_t sizeForward, size_t sizeReverse, char alloc);
-void allocate_new_page(size_t size);
+void *malloc_block(size_t size);
+size_t malloc_blocks(size_t size, size_t n, void **ptrs);
+void sort_addresses(void **ptrs, size_t n);
+int compare_addresses(const void *a, const void *b);
+void free_block(struct header *h);
+void quick_free(struct header *h);
+void flush_quick(int bin);
+char resize_block(struct header *h, size_t size);
+struct thread_cache *get_cache();
+void refill_cache(struct thread_cache *cache, int bin);
+void cache_block(void *p, size_t size);
+void drain_cache(struct thread_cache *cache, int bin, int count);
+void init_cache_key();
+void destroy_cache(void *p);
+void release_block(void *p);
+void *huge_malloc(size_t size);
+void *huge_memalign(size_t align, size_t size);
+void huge_free(struct header *h);
+void *memalign_block(size_t align, size_t size);
+void register_fork_handlers();
+void fork_prepare();
+void fork_done();
+void *map_region(size_t minSize, size_t *size);
+void *reuse_region(size_t minSize, size_t maxSize);
+void release_region(void *p, size_t size);
+void trim_regions();
+void unlink_region(struct retained_region *r);
+void *arena_grow(struct mm_arena *arena, size_t size);
+struct arena_chunk *get_chunk(size_t size);
+void put_chunk(struct arena_chunk *c);
+void *slab_malloc(size_t size);
+void slab_free(struct slab *slab, void *p);
+struct slab *find_slab(void *p);
+int insert_slab(struct slab *slab);
+void delete_slab(struct slab *slab);
+void pack_header(struct header *h, size_t sizeForward, size_t bits);
+void decommit_block(struct header *h);
+void decommit_idle();
+void add_idle(struct tree_node *t);
+void remove_idle(struct tree_node *t);
+void commit_block(struct header *h, size_t size);
+struct header *allocate_new_page(size_t size);
+struct header *find_fit(size_t size);
 char seperate_page(struct header *h, size_t size);
 void pack_free(struct free_node *f, struct free_node *prev, struct free_node *next);
 void add_free(void *f);
 void remove_free(void *f);
+void replace_free(void *f, void *g);
+struct tree_node *tree_insert(struct tree_node *t, struct tree_node *n);
+struct tree_node *tree_remove(struct tree_node *t, struct tree_node *n);
+struct tree_node *tree_merge(struct tree_node *a, struct tree_node *b);
+struct tree_node *tree_best_fit(size_t size);
 
 /* Checker Functions */
 void check_implicit_list(void *p);
 void check_implicit_cycle(void *p);
 void check_explicit_list();
 void check_explicit_cycle(void *f);
+void check_tree(struct tree_node *t, struct tree_node *low, struct tree_node *high);
+void check_idle_list();
+void check_slabs();
+void check_regions();
+void check_quick_lists();
+
+/* Statistics Functions */
+void stats_count_free(struct mm_stats *stats, void *f);
+void stats_count_tree(struct mm_stats *stats, struct tree_node *t);
 
 /* Global Variables */
-void *first_free = NULL;
+void *free_lists[NUM_CLASSES];
+struct tree_node *free_tree = NULL;
+unsigned long free_classes = 0; /* bit i is set when free_lists[i] is not empty, bit TREE_CLASS when free_tree is not empty */
+
+/* 
+ * Decommit Variables.
+ * decommit is set by mm_set_decommit, and nothing is decommitted unless it is.
+ * idle_head and idle_tail are the oldest and newest blocks on the idle list, and decommit_pass counts the passes over it.
+ */
+int decommit = 0;
+struct tree_node *idle_head = NULL;
+struct tree_node *idle_tail = NULL;
+unsigned long decommit_pass = 0;
+size_t decommit_clock = 0; /* bytes of tree blocks freed since the last decommit pass */
+
+/* 
+ * Quick List Variables.
+ * quick_lists[i] holds freed blocks of (i+2)*ALIGNMENT bytes that have not been coalesced, most recently freed first, and quick_counts[i] their number.
+ * quick_total is the number of blocks on all of them.
+ */
+void *quick_lists[QUICK_BINS];
+int quick_counts[QUICK_BINS];
+int quick_total = 0;
+
+/* 
+ * Slab Variables.
+ * Writers of the slab table hold the heap lock and make slab_table_seq odd while they work.
+ * This lets find_slab read the table without the lock, retrying if a writer was active.
+ */
+struct slab *slabs[SLAB_CLASSES];
+int slab_counts[SLAB_CLASSES];
+struct slab_entry slab_table[SLAB_TABLE_SIZE];
+int slab_table_count = 0;
+unsigned long slab_table_seq = 0;
+
+/* 
+ * Region Cache Variables.
+ * retained[i] holds released regions of i+1 pages, most recently released first.
+ * oldest_region and newest_region are the ends of the list of all retained regions in the order they were released.
+ * peak_pages is the high-water mark of the heap, the most pages it has had in use right after mapping a new region.
+ * The region clock counts releases and reuses, and is used to find regions that have been idle for too long.
+ * spare_region is the sentinel of the last region that free_block kept in the heap when it became wholly free, it may have been used again since.
+ */
+struct retained_region *retained[RETAIN_BUCKETS];
+struct retained_region *oldest_region = NULL;
+struct retained_region *newest_region = NULL;
+size_t retained_pages = 0;
+size_t peak_pages = 0;
+unsigned long region_clock = 0;
+struct header *spare_region = NULL;
+
+/* 
+ * Arena Variables.
+ * arena_chunks holds the chunks of ARENA_CHUNK bytes given back by arenas, still committed.
+ */
+struct arena_chunk *arena_chunks = NULL;
+int arena_chunk_count = 0;
+
+/* 
+ * Growth Variables.
+ * growth_min and growth_max bound the chunks the heap grows by, in bytes, and growth_chunk is the size of the next one.
+ * heap_requests counts the heap blocks allocated, and growth_stamp is its value at the last growth.
+ * heap_live is the bytes of allocated heap blocks, and heap_peak the most there were at any growth.
+ */
+size_t growth_min = 0;
+size_t growth_max = 0;
+size_t growth_chunk = 0;
+unsigned long heap_requests = 0;
+unsigned long growth_stamp = 0;
+size_t heap_live = 0;
+size_t heap_peak = 0;
+
+/* Counters reported by mm_stats, the fields describing free blocks are found when it is called instead */
+struct mm_stats heap_stats;
+
+/* 
+ * When threaded is set the heap above is shared by all threads and protected by heap_lock, and local_cache is private to each thread.
+ * Otherwise the heap is used directly by the only thread.
+ */
+int threaded = 0;
+pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long heap_generation = 1;
+__thread struct thread_cache local_cache;
+pthread_key_t cache_key;
+pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
 
 /**********************************************************
  * Primary Functions
@@ -86,196 +495,1546 @@ void *first_free = NULL;
 
 /* 
  * mm_init - initialize the malloc package.
+ * Any blocks still held by thread caches, quick lists, slabs in the slab table, retained regions, or cached arena chunks belong to the previous heap and are dropped.
  */
 int mm_init(void)
 {
-  first_free = NULL;
+  pthread_mutex_lock(&heap_lock);
+  memset(free_lists, 0, sizeof(free_lists));
+  free_tree = NULL;
+  free_classes = 0;
+  decommit_clock = 0;
+  idle_head = NULL;
+  idle_tail = NULL;
+  decommit_pass = 0;
+  memset(quick_lists, 0, sizeof(quick_lists));
+  memset(quick_counts, 0, sizeof(quick_counts));
+  quick_total = 0;
+  memset(slabs, 0, sizeof(slabs));
+  memset(slab_counts, 0, sizeof(slab_counts));
+  slab_table_count = 0;
+  memset(retained, 0, sizeof(retained));
+  oldest_region = NULL;
+  newest_region = NULL;
+  retained_pages = 0;
+  peak_pages = 0;
+  spare_region = NULL;
+  arena_chunks = NULL;
+  arena_chunk_count = 0;
+  if (growth_min == 0) {
+    growth_min = GROWTH_MIN * mem_pagesize();
+    growth_max = GROWTH_MAX * mem_pagesize();
+  }
+  growth_chunk = growth_min;
+  heap_requests = 0;
+  growth_stamp = 0;
+  heap_live = 0;
+  heap_peak = 0;
+  memset(&heap_stats, 0, sizeof(heap_stats));
+  heap_generation++;
+  pthread_mutex_unlock(&heap_lock);
   
   return 0;
 }
 
+/*
+ * mm_set_threaded - Turn the thread-safe mode on or off, this must be called before mm_init.
+ * In the thread-safe mode small blocks are cached per thread and the heap is protected by a lock.
+ * Otherwise the caches are not used, since cached blocks keep their pages from being unallocated.
+ * The heap lock is held across fork, so a child never sees the heap while another thread is changing it.
+ */
+void mm_set_threaded(int enable)
+{
+  static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+  threaded = enable;
+  if (enable) {
+    pthread_once(&atfork_once, register_fork_handlers);
+  }
+}
+
+/*
+ * mm_set_decommit - Turn decommitting the idle pages of large free blocks on or off, this must be called before mm_init.
+ * It is off by default, since a block used again after its pages were decommitted faults them back in one at a time.
+ */
+void mm_set_decommit(int enable)
+{
+  decommit = enable;
+}
+
+/*
+ * mm_set_growth - Bound the chunks the heap grows by to between "min" and "max" bytes, which are rounded up to whole pages.
+ * A min of 0 restores the default bounds of GROWTH_MIN and GROWTH_MAX pages, and a max below min is raised to it.
+ * The bounds hold from the next call to mm_init.
+ */
+void mm_set_growth(size_t min, size_t max)
+{
+  pthread_mutex_lock(&heap_lock);
+  if (min == 0) {
+    min = GROWTH_MIN * mem_pagesize();
+    max = GROWTH_MAX * mem_pagesize();
+  }
+  growth_min = PAGE_ALIGN(min);
+  growth_max = max > growth_min ? PAGE_ALIGN(max) : growth_min;
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * mm_stats - Fill in the statistics of the heap.
+ * The counters are kept as the heap is used, while the free blocks are counted by walking the free lists and the tree.
+ * Walking them makes this too slow to call for every request.
+ */
+void mm_stats(struct mm_stats *stats)
+{
+  int class;
+  int bucket;
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+  *stats = heap_stats;
+  for (class = 0; class < NUM_CLASSES; class++) {
+    struct free_node *f;
+    for (f = free_lists[class]; f != NULL; f = GET_NEXT_FREE(f)) {
+      stats_count_free(stats, f);
+    }
+  }
+  stats_count_tree(stats, free_tree);
+  for (bucket = 0; bucket < RETAIN_BUCKETS; bucket++) {
+    struct retained_region *r;
+    for (r = retained[bucket]; r != NULL; r = r->next) {
+      stats->retained += r->size;
+    }
+  }
+  stats->retained += arena_chunk_count * ARENA_CHUNK;
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+}
+
 /* 
  * mm_malloc - Allocate a block of memory of "size" bytes. 
- * If the desired size is not a multiple of 16 it will be rounded up.
- * If the desired size is larger than the largest available space in the heap a new page will be allocated.
- * Otherwise it will search the free list for a block that is large enough to fit the requested size and allocate it.
+ * If the desired size is not a multiple of 16 it will be rounded up, heap blocks round up the size including their header instead.
+ * Sizes of more than HUGE_THRESHOLD bytes get a mapping of their own and never touch the free lists.
+ * In the thread-safe mode small sizes are taken from the thread cache, which is refilled in a batch from the heap when it is empty.
+ * Larger sizes are allocated from the heap while holding the heap lock.
+ * Returns NULL if the size is more than MAX_REQUEST bytes, or if the memory for it can not be mapped.
  */
 void *mm_malloc(size_t size)
 {
-  int newsize = ALIGN(size);
-  struct header *h;
+  size_t newsize = ALIGN(size);
+  void *p;
 
-  // If this is the first call to malloc, allocate a new page
-  if (first_free == NULL) {
-    allocate_new_page(newsize);
+  if (size > MAX_REQUEST) {
+    return NULL;
   }
 
-  // Search for a free block that is large enough to fit the requested size
-  struct free_node *f = first_free;
-  while (f != NULL) {
-    h = GET_HEADER(f);
-    if (seperate_page(h, newsize)) { return GET_PAYLOAD(h); }
-    f = GET_NEXT_FREE(f);
+  // Every slab object and cached block must be able to hold a free node
+  if (newsize < sizeof(struct free_node)) {
+    newsize = sizeof(struct free_node);
   }
 
-  // If no free block is found, allocate a new page
-  allocate_new_page(newsize);
-  h = GET_HEADER(first_free);
-  if (seperate_page(h, newsize)) { return GET_PAYLOAD(h); }
-  printf("Error: malloc failed to allocate memory\n");
-  exit(1);
+  // If the block is huge, give it its own mapping
+  if (newsize > HUGE_THRESHOLD) {
+    if (threaded) { pthread_mutex_lock(&heap_lock); }
+    p = huge_malloc(newsize);
+    if (threaded) { pthread_mutex_unlock(&heap_lock); }
+    return p;
+  }
+
+  // If there is only one thread, allocate from the heap directly
+  if (!threaded) {
+    return malloc_block(size);
+  }
+
+  // If the block is small, pop it from the thread cache
+  if (newsize <= CACHE_MAX) {
+    struct thread_cache *c = get_cache();
+    int bin = GET_BIN(newsize);
+    if (c->bins[bin] == NULL) {
+      refill_cache(c, bin);
+      if (c->bins[bin] == NULL) {
+        return NULL;
+      }
+    }
+    p = c->bins[bin];
+    c->bins[bin] = GET_NEXT_FREE(p);
+    c->counts[bin]--;
+    return p;
+  }
+
+  pthread_mutex_lock(&heap_lock);
+  p = malloc_block(size);
+  pthread_mutex_unlock(&heap_lock);
+  return p;
 }
 
 /*
  * mm_free - Free the block of allocated memory at pointer p.
- * The block is marked as free and added to the free list.
- * If the next block is also free, it is coalesced with the current block.
- * If the previous block is also free, it is coalesced with the current block.
- * If the current block is a sentinel and the next block is a terminator, the page is unallocated.
- * However if the current block is also the last free block, it is not unallocated.
+ * In the thread-safe mode small blocks are pushed onto the thread cache of the calling thread, even if another thread allocated them.
+ * If the bin of the cache is full, a batch of its blocks is returned to the heap.
+ * Larger blocks are returned to the heap while holding the heap lock, and huge blocks are unallocated.
  */
 void mm_free(void *p)
 {
-  // Collect the header and add the current block to the explicit free list
-  struct header *h = GET_HEADER(p);
-  SET_ALLOC(h, 0);
-  add_free(p);
+  // If there is only one thread, free to the heap directly
+  if (!threaded) {
+    release_block(p);
+    return;
+  }
 
-  // If the next block is free, coalesce with it
-  struct header *next = GET_NEXT(h);
-  if (!IS_TERMINATOR(next) && !GET_ALLOC(next)) {
-    struct header *nextNext = GET_NEXT(next);
-    size_t newSize = GET_SIZE(h) + GET_SIZE(next) + sizeof(struct header)*2;
-    pack_header(h, newSize, h->sizeReverse, 0);
-    pack_header(nextNext, nextNext->sizeForward, newSize, GET_ALLOC(nextNext));
-    remove_free(GET_PAYLOAD(next));
-    #if DEBUG
-      check_implicit_cycle(GET_PAYLOAD(h));
-      check_explicit_cycle(GET_PAYLOAD(h));
-    #endif
+  // Objects in slabs have no header, so their size is found from their slab
+  struct slab *slab = find_slab(p);
+  size_t size = slab != NULL ? slab->size : GET_SIZE(GET_HEADER(p));
+
+  // If the block is small, push it onto the thread cache
+  if (size <= CACHE_MAX) {
+    cache_block(p, size);
+    return;
   }
 
-  // If the previous block is free, coalesce with it
-  if (!IS_SENTINEL(h) && !GET_ALLOC(GET_PREV(h))) {
-    h = GET_PREV(h);
-    struct header *next = GET_NEXT(h);
-    struct header *nextNext = GET_NEXT(next);
-    size_t newSize = GET_SIZE(h) + GET_SIZE(next) + sizeof(struct header)*2;
-    pack_header(h, newSize, h->sizeReverse, 0);
-    pack_header(nextNext, nextNext->sizeForward, newSize, GET_ALLOC(nextNext));
-    remove_free(GET_PAYLOAD(next));
-    #if DEBUG
-      check_implicit_cycle(GET_PAYLOAD(h));
-      check_explicit_cycle(GET_PAYLOAD(h));
-    #endif
+  pthread_mutex_lock(&heap_lock);
+  if (IS_HUGE(GET_HEADER(p))) {
+    huge_free(GET_HEADER(p));
+  }
+  else {
+    quick_free(GET_HEADER(p));
   }
+  pthread_mutex_unlock(&heap_lock);
+}
 
-  #if DEBUG
-    check_implicit_list(GET_PAYLOAD(h));
-    check_explicit_list();
-  #endif
+/*
+ * mm_free_sized - Free the block of allocated memory at pointer p, which was allocated with "size" bytes, as by mm_free.
+ * The size is not needed to find the block, since slab objects are found from their slab and other blocks from their header, so it is ignored.
+ */
+void mm_free_sized(void *p, size_t size)
+{
+  mm_free(p);
+}
+
+/*
+ * mm_realloc - Change the size of the allocated block at pointer p to "size" bytes and return its new payload pointer.
+ * If p is NULL this is the same as mm_malloc, and if size is 0 it is the same as mm_free.
+ * Objects in slabs stay in place as long as they still fit their slab.
+ * Heap blocks are resized in place if possible, by splitting off the excess or by absorbing a free next block.
+ * Huge blocks stay in place as long as the new size is still huge and fits their mapping.
+ * Only if that fails is a new block allocated, the data copied to it, and the old block freed.
+ * If the new block can not be allocated, NULL is returned and the old block is left as it was.
+ */
+void *mm_realloc(void *p, size_t size)
+{
+  size_t newsize = ALIGN(size);
+  size_t oldsize;
+  void *newp;
+  char resized;
+
+  if (p == NULL) {
+    return mm_malloc(size);
+  }
+  if (size == 0) {
+    mm_free(p);
+    return NULL;
+  }
+  if (size > MAX_REQUEST) {
+    return NULL;
+  }
+  if (newsize < sizeof(struct free_node)) {
+    newsize = sizeof(struct free_node);
+  }
+
+  // If the block is in a slab, keep it there as long as it fits
+  struct slab *slab = find_slab(p);
+  if (slab != NULL) {
+    if (newsize <= slab->size) { return p; }
+    oldsize = slab->size;
+  }
+  // If the block is huge, keep it in its mapping as long as it fits and is still huge
+  else if (IS_HUGE(GET_HEADER(p))) {
+    oldsize = GET_SIZE(GET_HEADER(p));
+    if (newsize > HUGE_THRESHOLD && newsize <= oldsize) { return p; }
+  }
+  // If the block is becoming huge, it has to move to its own mapping
+  else if (newsize > HUGE_THRESHOLD) {
+    oldsize = GET_SIZE(GET_HEADER(p));
+  }
+  // Otherwise try to resize the block in the heap
+  else {
+    if (threaded) { pthread_mutex_lock(&heap_lock); }
+    resized = resize_block(GET_HEADER(p), size);
+    if (threaded) { pthread_mutex_unlock(&heap_lock); }
+    if (resized) { return p; }
+    oldsize = GET_SIZE(GET_HEADER(p));
+  }
+
+  // Move the data to a new block
+  newp = mm_malloc(size);
+  if (newp == NULL) {
+    return NULL;
+  }
+  memcpy(newp, p, oldsize < size ? oldsize : size);
+  mm_free(p);
+  return newp;
+}
+
+/*
+ * mm_memalign - Allocate a block of "size" bytes whose payload is aligned to "align" bytes, which must be a power of 2.
+ * Alignments of up to 16 bytes are what mm_malloc gives already.
+ * Slab objects start at an offset from their page that is a multiple of 64, so small sizes rounded up to a multiple of a smaller alignment are taken from a slab.
+ * Otherwise a heap block large enough to hold an aligned payload is allocated and split around it.
+ * If that block would be huge, it gets a mapping of its own instead.
+ * The block is freed with mm_free and resized with mm_realloc, which does not keep the alignment if the block moves.
+ * Returns NULL if the size or the alignment is more than MAX_REQUEST bytes, or if the memory for the block can not be mapped.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+  size_t newsize = ALIGN(size);
+  void *p;
+
+  if (size > MAX_REQUEST || align > MAX_REQUEST) {
+    return NULL;
+  }
+  if (align <= ALIGNMENT) {
+    return mm_malloc(size);
+  }
+  if (newsize < sizeof(struct free_node)) {
+    newsize = sizeof(struct free_node);
+  }
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+
+  // If every object of the slab of the rounded up size is aligned, take one from it
+  // The thread cache is not used, as it can also hold heap blocks of that size
+  if ((ALIGN(sizeof(struct slab)) & (align - 1)) == 0 && ((newsize + align - 1) & ~(align - 1)) <= SLAB_MAX) {
+    p = slab_malloc((newsize + align - 1) & ~(align - 1));
+    if (p != NULL) {
+      STAT_ADD(in_use, (newsize + align - 1) & ~(align - 1));
+      if (threaded) { pthread_mutex_unlock(&heap_lock); }
+      return p;
+    }
+  }
+
+  if (newsize + align + MIN_BLOCK > HUGE_THRESHOLD) {
+    p = huge_memalign(align, newsize);
+  }
+  else {
+    p = memalign_block(align, newsize);
+  }
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+  return p;
+}
+
+/*
+ * mm_usable_size - Return the number of bytes that can be used at pointer p, which may be more than were asked for.
+ */
+size_t mm_usable_size(void *p)
+{
+  struct slab *slab;
+
+  if (p == NULL) {
+    return 0;
+  }
+  slab = find_slab(p);
+  return slab != NULL ? slab->size : GET_SIZE(GET_HEADER(p));
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of "size" bytes each and store their payload pointers in ptrs, returning the number allocated.
+ * Heap blocks are carved out of one free block large enough for as many of them as fit in HUGE_THRESHOLD bytes, in a single pass over it.
+ * Small sizes are taken from slabs or the thread cache one at a time as by mm_malloc, which already hand them out cheaply.
+ * Huge sizes each get a mapping of their own.
+ * In the thread-safe mode the heap lock is taken once for the whole batch.
+ * If memory runs out part way, the blocks allocated so far are kept and fewer than n are returned.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **ptrs)
+{
+  size_t newsize = ALIGN(size);
+  size_t i = 0, got;
+
+  if (size > MAX_REQUEST) {
+    return 0;
+  }
+  if (newsize < sizeof(struct free_node)) {
+    newsize = sizeof(struct free_node);
+  }
 
-  // If the current block is a sentinel and the next block is a terminator, unallocate the page
-  // If the current block is the last free block, do not unallocate the page
-  if (IS_SENTINEL(h) && IS_TERMINATOR(GET_NEXT(h)) && !IS_LAST_FREE(GET_PAYLOAD(h))) {
-    remove_free(GET_PAYLOAD(h));
-    mem_unmap(h, PAGE_ALIGN(GET_SIZE(h) + sizeof(struct header)*2));
+  // If the blocks are small, take them one at a time from their slab or the thread cache
+  // A batch of one gains nothing from being carved
+  if (n == 1 || newsize <= SLAB_MAX || (threaded && newsize <= CACHE_MAX)) {
+    for (i = 0; i < n; i++) {
+      if ((ptrs[i] = mm_malloc(size)) == NULL) {
+        break;
+      }
+    }
+    return i;
+  }
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+  if (newsize > HUGE_THRESHOLD) {
+    for (i = 0; i < n; i++) {
+      if ((ptrs[i] = huge_malloc(newsize)) == NULL) {
+        break;
+      }
+    }
+  }
+  else {
+    while (i < n && (got = malloc_blocks(size, n - i, ptrs + i)) > 0) {
+      i += got;
+    }
+  }
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+  return i;
+}
+
+/*
+ * mm_free_batch - Free the n allocated blocks whose payload pointers are in ptrs, using ptrs as scratch space, so its contents are unspecified afterwards.
+ * Each block is looked up once, in its slab or by its header, and slab objects and huge blocks are released right away.
+ * Heap blocks are gathered at the front of ptrs and sorted by address with sort_addresses, and each run of them that lie next to each other is merged into one block and freed with a single free_block.
+ * The run is then coalesced with its neighbours once, instead of every block being added to a free list only to be removed again by the next one.
+ * A block with no neighbour in the batch goes to the quick lists as by mm_free.
+ * In the thread-safe mode small blocks are pushed onto the thread cache as by mm_free, and the heap lock is taken once for the heap blocks.
+ */
+void mm_free_batch(size_t n, void **ptrs)
+{
+  size_t i, j, m = 0;
+  struct slab *slab;
+  struct header *h;
+  size_t size;
+
+  // A batch of one has nothing to coalesce with
+  if (n == 1) {
+    mm_free(ptrs[0]);
+    return;
+  }
+
+  // Small blocks go to the thread cache, which may take the heap lock itself to drain a bin, so this is done before taking it
+  // Every slab object is small enough for the thread cache, so the heap lock is only needed here for slab objects when there is one thread
+  for (i = 0; i < n; i++) {
+    slab = find_slab(ptrs[i]);
+    h = GET_HEADER(ptrs[i]);
+    size = slab != NULL ? slab->size : GET_SIZE(h);
+    if (threaded && size <= CACHE_MAX) {
+      cache_block(ptrs[i], size);
+    }
+    else if (slab != NULL) {
+      slab_free(slab, ptrs[i]);
+    }
+    else if (IS_HUGE(h)) {
+      if (threaded) { pthread_mutex_lock(&heap_lock); }
+      huge_free(h);
+      if (threaded) { pthread_mutex_unlock(&heap_lock); }
+    }
+    else {
+      ptrs[m++] = ptrs[i];
+    }
+  }
+  if (m == 0) {
+    return;
+  }
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+
+  // Merge each run of adjacent blocks into one allocated block and free it
+  // The terminator and region word lie between regions, so a run never crosses into another region
+  sort_addresses(ptrs, m);
+  for (i = 0; i < m; i = j) {
+    h = GET_HEADER(ptrs[i]);
+    size = GET_BLOCK(h);
+    for (j = i + 1; j < m && GET_HEADER(ptrs[j]) == (void*)h + size; j++) {
+      size += GET_BLOCK(GET_HEADER(ptrs[j]));
+      STAT_ADD(coalesces, 1);
+    }
+    if (j == i + 1) {
+      quick_free(h);
+      continue;
+    }
+    h->sizeForward = size | GET_PREV_BITS(h) | ALLOC;
+    free_block(h);
+  }
+
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+}
+
+/*
+ * mm_arena_create - Create an empty arena, taking its first chunk from the arena chunk cache or the region cache if possible.
+ * An arena must only be used by one thread at a time, only getting and giving back its chunks takes the heap lock.
+ * Returns NULL if its first chunk can not be mapped.
+ */
+struct mm_arena *mm_arena_create(void)
+{
+  struct arena_chunk *c;
+  struct mm_arena *arena;
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+  c = get_chunk(ARENA_CHUNK);
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+  if (c == NULL) {
+    return NULL;
+  }
+
+  arena = (void*)c + ALIGN(sizeof(struct arena_chunk));
+  arena->chunks = c;
+  arena->next = (void*)arena + ALIGN(sizeof(struct mm_arena));
+  arena->end = (void*)c + c->size;
+  return arena;
+}
+
+/*
+ * mm_arena_alloc - Allocate "size" bytes from the arena, rounded up to a multiple of 16.
+ * The object is bumped out of the current chunk, and only if it does not fit there is another chunk taken.
+ * The object can not be freed or resized, it lives until the arena is reset or destroyed.
+ * Returns NULL if the size is more than MAX_REQUEST bytes, or if no chunk for it can be mapped.
+ */
+void *mm_arena_alloc(struct mm_arena *arena, size_t size)
+{
+  size_t newsize = size <= ALIGNMENT ? ALIGNMENT : ALIGN(size);
+  void *p = arena->next;
+
+  if (size > MAX_REQUEST) {
+    return NULL;
+  }
+  if (newsize > (size_t)(arena->end - p)) {
+    return arena_grow(arena, newsize);
+  }
+  arena->next = p + newsize;
+  return p;
+}
+
+/*
+ * mm_arena_reset - Free every object of the arena at once.
+ * Every chunk but the one holding the arena is given back, and the arena starts bumping its first chunk again.
+ */
+void mm_arena_reset(struct mm_arena *arena)
+{
+  struct arena_chunk *first = (void*)arena - ALIGN(sizeof(struct arena_chunk));
+  struct arena_chunk *c = arena->chunks;
+
+  if (c != first || c->next != NULL) {
+    if (threaded) { pthread_mutex_lock(&heap_lock); }
+    while (c != NULL) {
+      struct arena_chunk *next = c->next;
+      if (c != first) {
+        put_chunk(c);
+      }
+      c = next;
+    }
+    if (threaded) { pthread_mutex_unlock(&heap_lock); }
+  }
+
+  first->next = NULL;
+  arena->chunks = first;
+  arena->next = (void*)arena + ALIGN(sizeof(struct mm_arena));
+  arena->end = (void*)first + first->size;
+}
+
+/*
+ * mm_arena_destroy - Free every object of the arena and the arena itself, giving back all of its chunks.
+ */
+void mm_arena_destroy(struct mm_arena *arena)
+{
+  struct arena_chunk *c = arena->chunks;
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+  while (c != NULL) {
+    struct arena_chunk *next = c->next;
+    put_chunk(c);
+    c = next;
+  }
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+}
+
+/********************************************************
+ * Helper Functions
+ ********************************************************/
+
+/* 
+ * malloc_block - Allocate a block with a payload of at least "size" bytes.
+ * Blocks of up to SLAB_MAX bytes are taken from a slab if possible.
+ * A block of the same size on its quick list is handed straight back without splitting anything.
+ * Otherwise it will search the segregated free lists for a block that is large enough to fit the requested size and allocate it.
+ * If no free block is large enough a new page will be allocated.
+ * The heap lock must be held.
+ */
+void *malloc_block(size_t size)
+{
+  struct header *h;
+
+  // If the block is small, take it from a slab
+  if (size <= SLAB_MAX) {
+    void *p = slab_malloc(size <= ALIGNMENT ? ALIGNMENT : ALIGN(size));
+    if (p != NULL) {
+      STAT_ADD(in_use, size <= ALIGNMENT ? ALIGNMENT : ALIGN(size));
+      return p;
+    }
+  }
+
+  // If a block of this size was freed recently, reuse it as it is
+  size = GET_BLOCK_SIZE(size);
+  if (size <= QUICK_MAX && quick_lists[GET_QUICK_BIN(size)] != NULL) {
+    int bin = GET_QUICK_BIN(size);
+    void *p = quick_lists[bin];
+    quick_lists[bin] = GET_NEXT_FREE(p);
+    quick_counts[bin]--;
+    quick_total--;
+    GET_HEADER(p)->sizeForward &= ~QUICK;
+    heap_requests++;
+    return p;
+  }
+
+  // Search for a free block that is large enough to fit the requested size
+  // If no free block is found, allocate a new page
+  h = find_fit(size);
+  if (h == NULL) {
+    h = allocate_new_page(size);
+    if (h == NULL) {
+      return NULL;
+    }
+  }
+  heap_requests++;
+  if (seperate_page(h, size)) {
+    LIVE_ADD(GET_BLOCK(h));
+    return GET_PAYLOAD(h);
+  }
+  printf("Error: malloc failed to allocate memory\n");
+  exit(1);
+}
+
+/*
+ * malloc_blocks - Allocate up to n blocks with a payload of at least "size" bytes each from one free block, storing their payload pointers in ptrs.
+ * A free block is found for all of them together, as many as fit in HUGE_THRESHOLD bytes but at least one, and split once by seperate_page.
+ * The allocated part is then cut into the blocks in a single pass, the last one keeping any excess seperate_page left with it.
+ * Returns the number of blocks allocated.
+ * The heap lock must be held.
+ */
+size_t malloc_blocks(size_t size, size_t n, void **ptrs) {
+  struct header *h;
+  size_t i, last;
+
+  size = GET_BLOCK_SIZE(size);
+  if (n > HUGE_THRESHOLD / size) {
+    n = HUGE_THRESHOLD / size > 0 ? HUGE_THRESHOLD / size : 1;
+  }
+
+  // Find or map a free block for the whole batch and allocate it as one block
+  h = find_fit(size * n);
+  if (h == NULL) {
+    h = allocate_new_page(size * n);
+    if (h == NULL) {
+      return 0;
+    }
+  }
+  heap_requests += n;
+  if (!seperate_page(h, size * n)) {
+    printf("Error: malloc failed to allocate memory\n");
+    exit(1);
+  }
+  LIVE_ADD(GET_BLOCK(h));
+  STAT_ADD(splits, n - 1);
+
+  // Cut it into n blocks, only the first can be a sentinel or follow a free block
+  // The block after the last one already counts it as allocated
+  last = GET_BLOCK(h) - (n - 1) * size;
+  for (i = 0; i < n; i++) {
+    h->sizeForward = (i < n - 1 ? size : last) | (i == 0 ? GET_PREV_BITS(h) : PREV_ALLOC) | ALLOC;
+    ptrs[i] = GET_PAYLOAD(h);
+    h = GET_NEXT(h);
+  }
+
+  #if DEBUG
+    check_implicit_list(ptrs[0]);
+  #endif
+
+  return n;
+}
+
+/*
+ * sort_addresses - Sort the n payload pointers in ptrs by address.
+ * The batches of mm_free_batch are mostly a handful of blocks, which insertion sort orders without calling compare_addresses for each pair.
+ */
+void sort_addresses(void **ptrs, size_t n) {
+  size_t i, j;
+  void *p;
+
+  if (n > SORT_MIN) {
+    qsort(ptrs, n, sizeof(void*), compare_addresses);
+    return;
+  }
+  for (i = 1; i < n; i++) {
+    p = ptrs[i];
+    for (j = i; j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)p; j--) {
+      ptrs[j] = ptrs[j - 1];
+    }
+    ptrs[j] = p;
+  }
+}
+
+/*
+ * compare_addresses - Order payload pointers by address, for qsort.
+ */
+int compare_addresses(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)*(void* const*)a;
+  uintptr_t y = (uintptr_t)*(void* const*)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * free_block - Return the allocated block with header h to the heap.
+ * If the next block is also free, it is removed from its free list and coalesced with the current block.
+ * If the previous block is also free, which is known from the bit in the current header, it is removed from its free list and coalesced with the current block.
+ * The coalesced block is then given a footer and added to the free list of its size class.
+ * If a neighbour had decommitted pages they stay decommitted, and the coalesced block is marked as decommitted.
+ * If decommitting is on, once enough bytes have been freed into the tree, the blocks that have stayed on the idle list since the last pass are decommitted.
+ * If the current block is a sentinel and the next block is a terminator, its region is wholly free and is released to the region cache.
+ * However one wholly free region, the spare region, is kept as a free block, so a heap that keeps emptying and filling a region does not release and reuse it each time.
+ * The heap lock must be held.
+ */
+void free_block(struct header *h)
+{
+  // Mark the current block as free
+  LIVE_ADD(-GET_BLOCK(h));
+  pack_header(h, GET_BLOCK(h), GET_PREV_BITS(h));
+
+  char decommitted = 0;
+
+  // If the next block is free, coalesce with it
+  // The terminator counts as allocated, so it is never coalesced
+  struct header *next = GET_NEXT(h);
+  if (!GET_ALLOC(next)) {
+    decommitted |= IS_DECOMMITTED(next);
+    remove_free(GET_PAYLOAD(next));
+    pack_header(h, GET_BLOCK(h) + GET_BLOCK(next), GET_PREV_BITS(h));
+    STAT_ADD(coalesces, 1);
+    #if DEBUG
+      check_implicit_cycle(GET_PAYLOAD(h));
+    #endif
+  }
+
+  // If the previous block is free, coalesce with it
+  // The sentinel counts its previous block as allocated, so it is never coalesced past
+  if (!GET_PREV_ALLOC(h)) {
+    struct header *prev = GET_PREV(h);
+    decommitted |= IS_DECOMMITTED(prev);
+    remove_free(GET_PAYLOAD(prev));
+    pack_header(prev, GET_BLOCK(prev) + GET_BLOCK(h), GET_PREV_BITS(prev));
+    h = prev;
+    STAT_ADD(coalesces, 1);
+    #if DEBUG
+      check_implicit_cycle(GET_PAYLOAD(h));
+    #endif
+  }
+
+  // If the region is now wholly free and another wholly free region is the spare, keep the larger of the two as the spare
+  // and release the other to the region cache
+  if (IS_SENTINEL(h) && IS_TERMINATOR(GET_NEXT(h))) {
+    struct header *spare = spare_region;
+    spare_region = h;
+    if (spare != NULL && spare != h && !GET_ALLOC(spare) && IS_TERMINATOR(GET_NEXT(spare))) {
+      if (GET_BLOCK(spare) >= GET_BLOCK(h)) {
+        spare_region = spare;
+        release_region(GET_REGION(h), *GET_REGION(h));
+        return;
+      }
+      remove_free(GET_PAYLOAD(spare));
+      release_region(GET_REGION(spare), *GET_REGION(spare));
+    }
+  }
+  add_free(GET_PAYLOAD(h));
+  if (decommitted) {
+    remove_idle(GET_PAYLOAD(h));
+    ((struct tree_node*)GET_PAYLOAD(h))->decommitted = 1;
+  }
+
+  // Count the bytes freed into the tree, and decommit the idle tree blocks once there are enough of them
+  if (decommit && GET_CLASS(GET_BLOCK(h)) == TREE_CLASS) {
+    decommit_clock += GET_BLOCK(h);
+    if (decommit_clock >= DECOMMIT_PERIOD * mem_pagesize()) {
+      decommit_clock = 0;
+      decommit_idle();
+    }
+  }
+
+  #if DEBUG
+    check_implicit_list(GET_PAYLOAD(h));
+    check_explicit_list();
+  #endif
+}
+
+/*
+ * quick_free - Return the allocated block with header h to the heap, deferring its coalescing if it is small.
+ * A block of up to QUICK_MAX bytes is marked QUICK and pushed onto the quick list of its size, where it still counts as allocated.
+ * If the list then holds more than QUICK_LIMIT blocks, they are all coalesced.
+ * Larger blocks are freed by free_block right away.
+ * The heap lock must be held.
+ */
+void quick_free(struct header *h) {
+  size_t size = GET_BLOCK(h);
+  int bin;
+
+  if (size > QUICK_MAX) {
+    free_block(h);
+    return;
+  }
+  bin = GET_QUICK_BIN(size);
+  h->sizeForward |= QUICK;
+  GET_NEXT_FREE(GET_PAYLOAD(h)) = quick_lists[bin];
+  quick_lists[bin] = GET_PAYLOAD(h);
+  quick_counts[bin]++;
+  quick_total++;
+  if (quick_counts[bin] > QUICK_LIMIT) {
+    flush_quick(bin);
+  }
+
+  #if DEBUG
+    check_quick_lists();
+  #endif
+}
+
+/*
+ * flush_quick - Free every block on the quick list "bin" with free_block, coalescing each with its free neighbours.
+ * The heap lock must be held.
+ */
+void flush_quick(int bin) {
+  while (quick_lists[bin] != NULL) {
+    void *p = quick_lists[bin];
+    quick_lists[bin] = GET_NEXT_FREE(p);
+    quick_counts[bin]--;
+    quick_total--;
+    GET_HEADER(p)->sizeForward &= ~QUICK;
+    free_block(GET_HEADER(p));
+  }
+}
+
+/*
+ * resize_block - Try to resize the allocated block with header h to a payload of at least "size" bytes.
+ * If the block is too small and the next block is free and large enough to make up the difference, the next block is absorbed and its pages committed.
+ * If the block is then larger than needed by at least MIN_BLOCK bytes, the excess is split off and freed.
+ * If the block can not be resized in place the function will return 0.
+ * The heap lock must be held.
+ */
+char resize_block(struct header *h, size_t size) {
+  struct header *next = GET_NEXT(h);
+
+  size = GET_BLOCK_SIZE(size);
+
+  // If the block is too small, absorb the next block if it is free and large enough
+  if (GET_BLOCK(h) < size) {
+    if (GET_ALLOC(next) || GET_BLOCK(h) + GET_BLOCK(next) < size) {
+      return 0;
+    }
+    if (IS_DECOMMITTED(next)) {
+      commit_block(next, GET_BLOCK(next));
+    }
+    remove_free(GET_PAYLOAD(next));
+    LIVE_ADD(GET_BLOCK(next));
+    pack_header(h, GET_BLOCK(h) + GET_BLOCK(next), GET_PREV_BITS(h) | ALLOC);
+  }
+
+  // If the block is larger than needed by at least MIN_BLOCK bytes, split off the excess and free it
+  if (GET_BLOCK(h) - size >= MIN_BLOCK) {
+    struct header *newBlock = (void*)h + size;
+    pack_header(newBlock, GET_BLOCK(h) - size, PREV_ALLOC | ALLOC);
+    pack_header(h, size, GET_PREV_BITS(h) | ALLOC);
+    STAT_ADD(splits, 1);
+    free_block(newBlock);
+  }
+
+  #if DEBUG
+    check_implicit_list(GET_PAYLOAD(h));
+    check_explicit_list();
+  #endif
+
+  return 1;
+}
+
+/*
+ * get_cache - Get the thread cache of the calling thread.
+ * If the cache was filled from an earlier heap its blocks no longer exist, so it is emptied.
+ * The first time a thread uses its cache it is registered to be returned to the heap when the thread exits.
+ */
+struct thread_cache *get_cache() {
+  if (local_cache.generation != heap_generation) {
+    char first = local_cache.generation == 0;
+    memset(local_cache.bins, 0, sizeof(local_cache.bins));
+    memset(local_cache.counts, 0, sizeof(local_cache.counts));
+    local_cache.generation = heap_generation;
+
+    // Registering the cache may allocate, so it is only done once the cache is ready to be used
+    if (first) {
+      pthread_once(&cache_key_once, init_cache_key);
+      pthread_setspecific(cache_key, &local_cache);
+    }
+  }
+  return &local_cache;
+}
+
+/*
+ * init_cache_key - Create the key whose destructor returns a thread cache to the heap when its thread exits.
+ */
+void init_cache_key() {
+  pthread_key_create(&cache_key, destroy_cache);
+}
+
+/*
+ * refill_cache - Allocate CACHE_BATCH blocks for the given bin from the heap and push them onto the cache.
+ * The heap lock is only taken once for the whole batch.
+ */
+void refill_cache(struct thread_cache *cache, int bin) {
+  size_t size = (bin + 1) * ALIGNMENT;
+  int i;
+
+  pthread_mutex_lock(&heap_lock);
+  for (i = 0; i < CACHE_BATCH; i++) {
+    void *p = malloc_block(size);
+    if (p == NULL) {
+      break;
+    }
+    GET_NEXT_FREE(p) = cache->bins[bin];
+    cache->bins[bin] = p;
+  }
+  pthread_mutex_unlock(&heap_lock);
+  cache->counts[bin] += i;
+}
+
+/*
+ * cache_block - Push the block at pointer p, with a payload of "size" bytes of at most CACHE_MAX, onto the thread cache.
+ * If the bin of the cache is full, a batch of its blocks is returned to the heap.
+ */
+void cache_block(void *p, size_t size) {
+  struct thread_cache *c = get_cache();
+  int bin = GET_BIN(size);
+
+  GET_NEXT_FREE(p) = c->bins[bin];
+  c->bins[bin] = p;
+  c->counts[bin]++;
+  if (c->counts[bin] >= CACHE_LIMIT) {
+    drain_cache(c, bin, CACHE_BATCH);
+  }
+}
+
+/*
+ * drain_cache - Return up to count blocks from the given bin of the cache to the heap.
+ * The heap lock is only taken once for the whole batch.
+ */
+void drain_cache(struct thread_cache *cache, int bin, int count) {
+  pthread_mutex_lock(&heap_lock);
+  while (count > 0 && cache->bins[bin] != NULL) {
+    void *p = cache->bins[bin];
+    cache->bins[bin] = GET_NEXT_FREE(p);
+    cache->counts[bin]--;
+    release_block(p);
+    count--;
+  }
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * destroy_cache - Return every block of an exiting thread's cache to the heap.
+ * Blocks from an earlier heap are dropped instead.
+ */
+void destroy_cache(void *p) {
+  struct thread_cache *cache = p;
+  int bin;
+
+  if (cache->generation != heap_generation) {
+    return;
+  }
+  for (bin = 0; bin < CACHE_BINS; bin++) {
+    drain_cache(cache, bin, cache->counts[bin]);
+  }
+}
+
+/*
+ * release_block - Return the allocated block at pointer p to its slab, or to the heap if it is not in a slab.
+ * Small heap blocks go onto a quick list, and huge blocks are unallocated instead.
+ * The heap lock must be held.
+ */
+void release_block(void *p) {
+  struct slab *slab = find_slab(p);
+  if (slab != NULL) {
+    slab_free(slab, p);
+  }
+  else if (IS_HUGE(GET_HEADER(p))) {
+    huge_free(GET_HEADER(p));
+  }
+  else {
+    quick_free(GET_HEADER(p));
+  }
+}
+
+/*
+ * huge_malloc - Allocate a huge block with a payload of "size" bytes in a mapping of its own.
+ * The region word records the size of the mapping, and the block takes up the whole mapping up to the terminator.
+ * The heap lock must be held, since mem_map is not thread-safe.
+ */
+void *huge_malloc(size_t size) {
+  size_t mapsize = PAGE_ALIGN(size + sizeof(size_t) + sizeof(struct header)*2);
+  size_t *region = mem_map(mapsize);
+  if (region == NULL) {
+    return NULL;
+  }
+  *region = mapsize | HUGE;
+  struct header *h = (struct header*)(region + 1);
+  h->sizeForward = (mapsize - sizeof(size_t) - sizeof(struct header)) | SENTINEL | PREV_ALLOC | ALLOC;
+  STAT_ADD(maps, 1);
+  STAT_ADD(in_use, GET_BLOCK(h));
+  return GET_PAYLOAD(h);
+}
+
+/*
+ * huge_memalign - Allocate a huge block with a payload of "size" bytes aligned to "align" bytes in a mapping of its own.
+ * The mapping is made large enough to hold an aligned payload, and the whole pages before and after the block are unallocated.
+ * The region word then sits right before the header, and records the size of the mapping from the start of its page.
+ * The heap lock must be held, since mem_map is not thread-safe.
+ */
+void *huge_memalign(size_t align, size_t size) {
+  size_t mapsize = PAGE_ALIGN(size + align + sizeof(size_t) + sizeof(struct header)*2);
+  void *start = mem_map(mapsize);
+  if (start == NULL) {
+    return NULL;
+  }
+
+  // Find the aligned payload and the pages the block and its region word need
+  void *p = (void*)(((uintptr_t)start + sizeof(size_t) + sizeof(struct header) + align - 1) & ~(uintptr_t)(align - 1));
+  size_t *region = p - sizeof(struct header) - sizeof(size_t);
+  void *low = (void*)((uintptr_t)region & ~(uintptr_t)(mem_pagesize() - 1));
+  void *high = (void*)PAGE_ALIGN((uintptr_t)p + size + sizeof(struct header));
+  if (low > start) {
+    mem_unmap(start, low - start);
+  }
+  if (high < start + mapsize) {
+    mem_unmap(high, start + mapsize - high);
+  }
+
+  *region = (high - low) | HUGE;
+  struct header *h = GET_HEADER(p);
+  h->sizeForward = (high - sizeof(struct header) - (void*)h) | SENTINEL | PREV_ALLOC | ALLOC;
+  STAT_ADD(maps, 1);
+  STAT_ADD(in_use, GET_BLOCK(h));
+  return p;
+}
+
+/*
+ * huge_free - Unallocate the mapping of the huge block with header h.
+ * The mapping starts at the page of the region word, which is only not the first word of the mapping for aligned huge blocks.
+ * The heap lock must be held, since mem_unmap is not thread-safe.
+ */
+void huge_free(struct header *h) {
+  STAT_ADD(unmaps, 1);
+  STAT_ADD(in_use, -GET_BLOCK(h));
+  mem_unmap((void*)((uintptr_t)GET_REGION(h) & ~(uintptr_t)(mem_pagesize() - 1)), *GET_REGION(h) & ~HUGE);
+}
+
+/*
+ * memalign_block - Allocate a heap block with a payload of at least "size" bytes aligned to "align" bytes.
+ * The free block found for an unaligned request is used if the aligned payload and a leading free block still fit in it.
+ * Otherwise a block with room for the payload, any alignment and a leading free block is found or mapped.
+ * If the payload of the block is not aligned, the part before the aligned payload is split off as a block of at least MIN_BLOCK bytes and freed.
+ * The excess after the payload is then split off and freed as well.
+ * The heap lock must be held.
+ */
+void *memalign_block(size_t align, size_t size) {
+  size_t bsize = GET_BLOCK_SIZE(size);
+  struct header *h = find_fit(bsize);
+
+  // If the aligned payload does not fit the block found, find one with room for any alignment
+  if (h == NULL || GET_BLOCK(h) < GET_ALIGN_LEAD(h, align) + bsize) {
+    h = find_fit(GET_BLOCK_SIZE(size + align + MIN_BLOCK));
+    if (h == NULL) {
+      h = allocate_new_page(GET_BLOCK_SIZE(size + align + MIN_BLOCK));
+      if (h == NULL) {
+        return NULL;
+      }
+    }
+  }
+  heap_requests++;
+  seperate_page(h, GET_ALIGN_LEAD(h, align) + bsize);
+  LIVE_ADD(GET_BLOCK(h));
+
+  // If the payload is not aligned, free the blocks before the aligned payload
+  if (GET_ALIGN_LEAD(h, align) != 0) {
+    size_t lead = GET_ALIGN_LEAD(h, align);
+    struct header *aligned = (void*)h + lead;
+    pack_header(aligned, GET_BLOCK(h) - lead, PREV_ALLOC | ALLOC);
+    pack_header(h, lead, GET_PREV_BITS(h) | ALLOC);
+    STAT_ADD(splits, 1);
+    free_block(h);
+    h = aligned;
+  }
+
+  resize_block(h, size);
+  return GET_PAYLOAD(h);
+}
+
+/*
+ * register_fork_handlers - Register fork_prepare and fork_done to be run around every fork.
+ */
+void register_fork_handlers() {
+  pthread_atfork(fork_prepare, fork_done, fork_done);
+}
+
+/*
+ * fork_prepare - Take the heap lock before fork, so the child does not get a heap that another thread was in the middle of changing.
+ */
+void fork_prepare() {
+  pthread_mutex_lock(&heap_lock);
+}
+
+/*
+ * fork_done - Release the heap lock after fork, in both the parent and the child.
+ */
+void fork_done() {
+  pthread_mutex_unlock(&heap_lock);
+}
+
+/*
+ * map_region - Get a region of at least minSize and at most *size bytes, and set *size to its size.
+ * A retained region from the region cache is used if there is one large enough, otherwise a new region of *size bytes is mapped.
+ * The heap lock must be held.
+ */
+void *map_region(size_t minSize, size_t *size) {
+  struct retained_region *r = reuse_region(minSize, *size);
+  if (r != NULL) {
+    *size = r->size;
+    return r;
+  }
+
+  void *p = mem_map(*size);
+  if (p == NULL) {
+    return NULL;
+  }
+  STAT_ADD(maps, 1);
+
+  // The heap has grown, so raise the high-water mark to the pages in use, counting the new region
+  // The region can then be retained when it is released, instead of being unallocated and mapped again the next time the heap grows
+  if (mem_reservedsize() / mem_pagesize() - retained_pages > peak_pages) {
+    peak_pages = mem_reservedsize() / mem_pagesize() - retained_pages;
+  }
+  return p;
+}
+
+/*
+ * reuse_region - Take the smallest retained region of at least minSize bytes from the region cache, and commit it.
+ * If it is larger than maxSize bytes it is split, and the rest of it is released back to the cache.
+ * Both sizes must be multiples of the page size.
+ * If no retained region is large enough the function will return NULL.
+ * The heap lock must be held.
+ */
+void *reuse_region(size_t minSize, size_t maxSize) {
+  long bucket = minSize / mem_pagesize() - 1;
+  struct retained_region *r;
+
+  // Find the smallest bucket that is not empty
+  for (; bucket < RETAIN_BUCKETS && retained[bucket] == NULL; bucket++);
+  if (bucket >= RETAIN_BUCKETS) {
+    return NULL;
+  }
+
+  // Take the most recently released region of the bucket
+  r = retained[bucket];
+  unlink_region(r);
+  region_clock++;
+
+  // If the region is too large, split off the rest
+  if (r->size > maxSize) {
+    release_region((void*)r + maxSize, r->size - maxSize);
+    r->size = maxSize;
+  }
+  mem_commit(r, r->size);
+
+  #if DEBUG
+    check_regions();
+  #endif
+
+  return r;
+}
+
+/*
+ * release_region - Release the region of "size" bytes at pointer p, which is no longer used, to the region cache.
+ * Retained regions are decommitted except for their first page, so they only take up address space.
+ * Regions larger than RETAIN_BUCKETS pages are unallocated right away.
+ * The cache is then trimmed.
+ * The heap lock must be held.
+ */
+void release_region(void *p, size_t size) {
+  long bucket = size / mem_pagesize() - 1;
+  struct retained_region *r = p;
+
+  if (bucket >= RETAIN_BUCKETS) {
+    STAT_ADD(unmaps, 1);
+    mem_unmap(p, size);
+    return;
+  }
+
+  // Decommit all but the first page, which keeps the region in the cache
+  mem_commit(p, mem_pagesize());
+  if (size > mem_pagesize()) {
+    mem_decommit(p + mem_pagesize(), size - mem_pagesize());
+  }
+
+  // Push the region onto the bucket of its page count, and onto the newest end of the release order
+  r->size = size;
+  r->prev = NULL;
+  r->next = retained[bucket];
+  if (r->next != NULL) {
+    r->next->prev = r;
+  }
+  retained[bucket] = r;
+  r->older = newest_region;
+  r->newer = NULL;
+  if (newest_region != NULL) {
+    newest_region->newer = r;
+  }
+  else {
+    oldest_region = r;
+  }
+  newest_region = r;
+  r->stamp = region_clock++;
+  retained_pages += bucket + 1;
+
+  trim_regions();
+
+  #if DEBUG
+    check_regions();
+  #endif
+}
+
+/*
+ * trim_regions - Unallocate retained regions until the cache is within its high-water mark and holds no region older than RETAIN_AGE.
+ * The cache may hold RETAIN_MAX pages, or as many as the pages in use are below the high-water mark, whichever is less.
+ * The oldest region is unallocated first, which is the oldest end of the release order.
+ * The heap lock must be held.
+ */
+void trim_regions() {
+  size_t used = mem_reservedsize() / mem_pagesize() - retained_pages;
+  size_t keep = used < peak_pages ? peak_pages - used : 0;
+  if (keep > RETAIN_MAX) {
+    keep = RETAIN_MAX;
+  }
+
+  // Unallocate the oldest region until the cache is small enough and the oldest region is young enough
+  while (oldest_region != NULL && (retained_pages > keep || region_clock - oldest_region->stamp > RETAIN_AGE)) {
+    struct retained_region *victim = oldest_region;
+    unlink_region(victim);
+    STAT_ADD(unmaps, 1);
+    mem_unmap(victim, victim->size);
+  }
+}
+
+/*
+ * unlink_region - Remove the retained region r from its bucket and from the release order.
+ * The heap lock must be held.
+ */
+void unlink_region(struct retained_region *r) {
+  long bucket = r->size / mem_pagesize() - 1;
+
+  if (r->prev != NULL) {
+    r->prev->next = r->next;
+  }
+  else {
+    retained[bucket] = r->next;
+  }
+  if (r->next != NULL) {
+    r->next->prev = r->prev;
+  }
+  if (r->older != NULL) {
+    r->older->newer = r->newer;
+  }
+  else {
+    oldest_region = r->newer;
+  }
+  if (r->newer != NULL) {
+    r->newer->older = r->older;
+  }
+  else {
+    newest_region = r->older;
+  }
+  retained_pages -= bucket + 1;
+}
+
+/*
+ * pack_header - Pack the header with the given size and bits.
+ * If the block is free its footer is written as well.
+ * The header of the next block is updated to record if this block is allocated, so it must already exist.
+ */
+void pack_header(struct header *h, size_t sizeForward, size_t bits) {
+  h->sizeForward = sizeForward | bits;
+  if (!(bits & ALLOC)) {
+    *GET_FOOTER(h) = sizeForward;
+  }
+  SET_PREV_ALLOC(GET_NEXT(h), bits & ALLOC);
+}
+
+/*
+ * decommit_block - Decommit the pages in the interior of the free block with header h, which must be in the tree.
+ * Pages that are already decommitted are left alone.
+ */
+void decommit_block(struct header *h) {
+  void *start = GET_INTERIOR_START(h);
+  void *end = GET_INTERIOR_END(h);
+  if (end > start) {
+    mem_decommit(start, end - start);
+  }
+  ((struct tree_node*)GET_PAYLOAD(h))->decommitted = 1;
+}
+
+/*
+ * decommit_idle - Decommit the blocks on the idle list that were added before the last decommit pass, and so have stayed free since then.
+ * The list is oldest first, so the pass stops at the first block added since the last one.
+ */
+void decommit_idle() {
+  struct tree_node *t;
+  while ((t = idle_head) != NULL && t->idle_pass < decommit_pass) {
+    remove_idle(t);
+    decommit_block(GET_HEADER(t));
+  }
+  decommit_pass++;
+}
+
+/*
+ * add_idle - Add the tree block t to the end of the idle list if decommitting is on and its interior covers at least DECOMMIT_MIN pages.
+ * Decommitting part of a huge page would split it, so no block is added when huge pages are on.
+ */
+void add_idle(struct tree_node *t) {
+  struct header *h = GET_HEADER(t);
+  t->idle = 0;
+  if (!decommit || mem_hugepages() || GET_INTERIOR_END(h) < GET_INTERIOR_START(h) + DECOMMIT_MIN * mem_pagesize()) {
+    return;
+  }
+  t->idle = 1;
+  t->idle_pass = decommit_pass;
+  t->idle_prev = idle_tail;
+  t->idle_next = NULL;
+  if (idle_tail != NULL) {
+    idle_tail->idle_next = t;
+  }
+  else {
+    idle_head = t;
+  }
+  idle_tail = t;
+}
+
+/*
+ * remove_idle - Remove the tree block t from the idle list, if it is on it.
+ */
+void remove_idle(struct tree_node *t) {
+  if (!t->idle) {
+    return;
+  }
+  if (t->idle_prev != NULL) {
+    t->idle_prev->idle_next = t->idle_next;
   }
+  else {
+    idle_head = t->idle_next;
+  }
+  if (t->idle_next != NULL) {
+    t->idle_next->idle_prev = t->idle_prev;
+  }
+  else {
+    idle_tail = t->idle_prev;
+  }
+  t->idle = 0;
 }
 
-/********************************************************
- * Helper Functions
- ********************************************************/
-
 /*
- * pack_header - Pack the header with the given size and allocation status.
+ * commit_block - Commit the decommitted pages of the free block with header h that are about to be used.
+ * If only the first "size" bytes are used and the rest becomes a free block of its own, the pages in the interior of the rest stay decommitted.
  */
-void pack_header(struct header *h, size_t sizeForward, size_t sizeReverse, char alloc) {
-  h->sizeForward = sizeForward | alloc;
-  h->sizeReverse = sizeReverse;
+void commit_block(struct header *h, size_t size) {
+  void *start = GET_INTERIOR_START(h);
+  void *end = GET_INTERIOR_END(h);
+  if (size < GET_BLOCK(h) && GET_INTERIOR_START((void*)h + size) < end) {
+    end = GET_INTERIOR_START((void*)h + size);
+  }
+  if (end > start) {
+    mem_commit(start, end - start);
+  }
 }
 
 /*
- * allocate_new_page - Allocate a new page of memory.
- * The new page will be sized such that the current size of the heap is doubled.
- * However if the this size is more then 32 pages, the size will be capped at 32 pages.
- * The new page will be added to the free list and sentinal/terminator headers will be added.
+ * allocate_new_page - Allocate a new page of memory with room for a block of "size" bytes.
+ * The heap grows by growth_chunk bytes, which adapts to how fast the heap has been growing.
+ * If the last chunk was used up by fewer than GROWTH_FAST heap block allocations the chunk doubles, and if it lasted for more than GROWTH_SLOW it halves, always staying within growth_min and growth_max.
+ * While the allocated heap blocks are below their peak, the heap is likely to need the difference again, so it grows by up to that much at once.
+ * With huge pages on, a heap larger than HUGE_GROWTH_MIN grows by whole huge pages instead.
+ * A retained region from the region cache is used instead of a new page when one is large enough for the whole chunk.
+ * Before the heap grows, the blocks on the quick lists are coalesced, and if that leaves a free block large enough it is returned instead.
+ * The new page will be added to the free list and the region word and sentinal/terminator headers will be added.
+ * Unless huge pages are on, the interior of the new free block is left decommitted, so its pages only count as committed once they are used.
+ * Returns the header of the new free block.
  */
-void allocate_new_page(size_t size) {
-  size_t newsize = size + sizeof(struct header)*2;
+struct header *allocate_new_page(size_t size) {
+  size_t minSize = PAGE_ALIGN(size + sizeof(size_t) + sizeof(struct header));
+  size_t newsize;
   void *p;
+  int bin;
+
+  // Coalesce the quick lists, which may make a block large enough
+  if (quick_total > 0) {
+    for (bin = 0; bin < QUICK_BINS; bin++) {
+      flush_quick(bin);
+    }
+    struct header *h = find_fit(size);
+    if (h != NULL) {
+      return h;
+    }
+  }
+
+  // Get the current size of the heap, not counting retained regions
+  size_t currentSize = mem_reservedsize() - retained_pages * mem_pagesize();
 
-  // Get the current size of the heap and double it
-  size_t currentSize = mem_heapsize();
-  size_t desiredSize;
-  size_t maxSize = PAGE_ALIGN(32*4096);
+  // Adapt the chunk to the number of heap blocks allocated since the last growth, the first page is always growth_min
   if (currentSize == 0) {
-    desiredSize = mem_pagesize();
+    growth_chunk = growth_min;
   }
-  else {
-    desiredSize = PAGE_ALIGN(currentSize*2);
+  else if (heap_requests - growth_stamp < GROWTH_FAST) {
+    growth_chunk *= 2;
+  }
+  else if (heap_requests - growth_stamp > GROWTH_SLOW) {
+    growth_chunk = PAGE_ALIGN(growth_chunk / 2);
+  }
+  if (growth_chunk < growth_min) {
+    growth_chunk = growth_min;
+  }
+  if (growth_chunk > growth_max) {
+    growth_chunk = growth_max;
   }
+  growth_stamp = heap_requests;
+  if (heap_live > heap_peak) {
+    heap_peak = heap_live;
+  }
+  newsize = growth_chunk;
 
-  // If the requested size is larger then what would be available by doubling the current size of the heap
-  // continue to double the size until it is sufficently large
-  while (desiredSize-currentSize < newsize) {
-    desiredSize += desiredSize;
+  // A heap never grows by more than its current size, so a small heap is at most doubled
+  if (newsize > PAGE_ALIGN(currentSize)) {
+    newsize = PAGE_ALIGN(currentSize) > growth_min ? PAGE_ALIGN(currentSize) : growth_min;
   }
 
-  // If the desired size is larger then 32 pages, cap it at 32 pages
-  if (desiredSize-currentSize >= maxSize) {
-    newsize = maxSize;
+  // If the allocated heap blocks are below their peak, grow by the difference, up to the chunk
+  if (heap_peak - heap_live > newsize) {
+    newsize = PAGE_ALIGN(heap_peak - heap_live) < growth_chunk ? PAGE_ALIGN(heap_peak - heap_live) : growth_chunk;
   }
-  else {
-    newsize = PAGE_ALIGN(desiredSize-currentSize);
+
+  // With huge pages on, a heap that has grown past HUGE_GROWTH_MIN grows by whole huge pages instead,
+  // which memlib maps aligned so the system can back them with huge pages
+  if (mem_hugepages() && currentSize >= HUGE_GROWTH_MIN) {
+    newsize = HPAGE_SIZE;
+  }
+
+  // A block larger than the chunk gets a page of its own size
+  if (newsize < minSize) {
+    newsize = minSize;
   }
 
-  // Allocate the new page
-  p = mem_map(newsize);
+  // Allocate the new page, reusing a retained region if one is large enough for the whole chunk
+  // Taking a smaller one would leave the heap in many small regions, such as the pages slabs have not used yet
+  p = map_region(newsize, &newsize);
   if (p == NULL) {
-    exit(1);
+    return NULL;
   }
   
-  // Setup the sentinal and terminator headers, and add the new page to the free list
-  struct header *sentinal = (struct header *)p;
-  pack_header(sentinal, newsize-sizeof(struct header), 0, 0);
-  add_free(GET_PAYLOAD(p));
-  struct header *terminator = GET_NEXT(sentinal);
-  pack_header(terminator, 0, newsize-sizeof(struct header), 0);
+  // Setup the region word, the sentinal and terminator headers, and add the new page to the free list
+  *(size_t*)p = newsize;
+  struct header *sentinal = p + sizeof(size_t);
+  struct header *terminator = p + newsize - sizeof(struct header);
+  terminator->sizeForward = ALLOC;
+  pack_header(sentinal, newsize - sizeof(size_t) - sizeof(struct header), SENTINEL | PREV_ALLOC);
+  add_free(GET_PAYLOAD(sentinal));
+  if (!mem_hugepages() && GET_CLASS(GET_BLOCK(sentinal)) == TREE_CLASS) {
+    remove_idle(GET_PAYLOAD(sentinal));
+    decommit_block(sentinal);
+  }
+
+  return sentinal;
+}
+
+/*
+ * find_fit - Find a free block that is large enough to fit the requested block size.
+ * Requests of TREE_THRESHOLD bytes or more are served best fit from the tree.
+ * Otherwise the free list of the requested size class is searched first fit, since it may also hold blocks that are too small.
+ * If nothing fits there, the first block of the next non-empty larger class is used, as any such block is large enough.
+ * If no free block is large enough the function will return NULL.
+ */
+struct header *find_fit(size_t size) {
+  int class = GET_CLASS(size);
+  struct tree_node *t;
+
+  if (class != TREE_CLASS) {
+    // Search the size class of the request
+    struct free_node *f = free_lists[class];
+    #if STATS
+      size_t scan = 0;
+    #endif
+    while (f != NULL) {
+      #if STATS
+        if (++scan > heap_stats.longest_scan) { heap_stats.longest_scan = scan; }
+      #endif
+      if (GET_BLOCK(GET_HEADER(f)) >= size) { return GET_HEADER(f); }
+      f = GET_NEXT_FREE(f);
+    }
+
+    // Take the first block of the smallest larger class that is not empty
+    unsigned long larger = free_classes & (~0UL << (class + 1));
+    if (larger == 0) {
+      return NULL;
+    }
+    class = __builtin_ctzl(larger);
+    if (class != TREE_CLASS) {
+      return GET_HEADER(free_lists[class]);
+    }
+  }
+
+  // Take the smallest block in the tree that is large enough
+  t = tree_best_fit(size);
+  return t == NULL ? NULL : GET_HEADER(t);
 }
 
 /*
- * seperate_page - check if the current free block is large enough to fit the requested size.
- * If the free block is large enough to fit the requested size and another block it will be split into two blocks.
+ * seperate_page - check if the current free block is large enough to fit the requested block size.
+ * If the free block is large enough to fit the requested size and another block of at least MIN_BLOCK bytes it will be split into two blocks.
  * The first block will be allocated and the second block will be added to the free list.
+ * If the free block had decommitted pages, those under the allocated block are committed, and the rest stay decommitted in the second block.
  * If the block is not large enough to fit the requested size the function will return 0.
  */
 char seperate_page(struct header *h, size_t size) {
   // If the block is large enough to fit the requested size
-  if (GET_SIZE(h) >= size) {
+  if (GET_BLOCK(h) >= size) {
+    char decommitted = IS_DECOMMITTED(h);
+    if (decommitted) {
+      commit_block(h, GET_BLOCK(h) - size >= MIN_BLOCK ? size : GET_BLOCK(h));
+    }
+
     // If the block is large enough to fit the requested size and another block
-    if (GET_SIZE(h) - size > sizeof(struct header)) {
+    if (GET_BLOCK(h) - size >= MIN_BLOCK) {
       // Calculate the size of the allocated block and the new block after it
-      size_t newSize1 = size + sizeof(struct header);
-      size_t newSize2 = GET_SIZE(h) - size;
+      size_t newSize1 = size;
+      size_t newSize2 = GET_BLOCK(h) - size;
 
       // Locate needed header pointers
-      struct header *next = GET_NEXT(h);
       struct header *newBlock = (void*)h + newSize1;
       
-      // Pack the headers and add the new block to the free list
-      pack_header(newBlock, newSize2, newSize1, 0);
-      add_free(GET_PAYLOAD(newBlock));
-      pack_header(next, next->sizeForward, newSize2, GET_ALLOC(next));
-      pack_header(h, newSize1, h->sizeReverse, 1);
+      // Pack the header of the new block and move it into the free list
+      // If the new block stays in the same size class it simply takes the place of the old block
+      // Otherwise the old block is removed first, since the new header may lie inside its tree node
+      if (GET_CLASS(newSize2) == GET_CLASS(GET_BLOCK(h)) && GET_CLASS(GET_BLOCK(h)) != TREE_CLASS) {
+        pack_header(newBlock, newSize2, PREV_ALLOC);
+        replace_free(GET_PAYLOAD(h), GET_PAYLOAD(newBlock));
+      }
+      else {
+        remove_free(GET_PAYLOAD(h));
+        pack_header(newBlock, newSize2, PREV_ALLOC);
+        add_free(GET_PAYLOAD(newBlock));
+        if (decommitted && GET_CLASS(newSize2) == TREE_CLASS) {
+          remove_idle(GET_PAYLOAD(newBlock));
+          ((struct tree_node*)GET_PAYLOAD(newBlock))->decommitted = 1;
+        }
+      }
+      h->sizeForward = newSize1 | GET_PREV_BITS(h);
+      STAT_ADD(splits, 1);
 
       #if DEBUG
         check_implicit_cycle(GET_PAYLOAD(newBlock));
       #endif
     }
-    // Allocate the block and remove it from the free list
-    SET_ALLOC(h, 1);
-    remove_free(GET_PAYLOAD(h));
+    else {
+      remove_free(GET_PAYLOAD(h));
+    }
+    // Allocate the block
+    pack_header(h, GET_BLOCK(h), GET_PREV_BITS(h) | ALLOC);
 
     #if DEBUG
       check_implicit_list(GET_PAYLOAD(h));
@@ -303,30 +2062,52 @@ void pack_free(struct free_node *f, struct free_node *prev, struct free_node *ne
 }
 
 /*
- * add_free - Add a free block to the free list.
- * If the free list is empty, the block is added as the first free block.
+ * add_free - Add a free block to the free list of its size class.
+ * If the block belongs in the tree it is inserted into the tree instead.
+ * If the free list is empty, the block is added as the first free block and the class is marked as not empty.
  * If the free list is not empty, the block is added to the front of the free list.
  */
 void add_free(void *f) {
+  int class = GET_CLASS(GET_BLOCK(GET_HEADER(f)));
+
+  // If the block is large, insert it into the tree with all of its pages committed, and put it on the idle list
+  if (class == TREE_CLASS) {
+    ((struct tree_node*)f)->decommitted = 0;
+    add_idle(f);
+    free_tree = tree_insert(free_tree, f);
+    free_classes |= 1UL << TREE_CLASS;
+    return;
+  }
+
   // If the free list is empty, add the block as the first free block
-  if (first_free == NULL) {
+  if (free_lists[class] == NULL) {
     pack_free(f, NULL, NULL);
-    first_free = f;
+    free_classes |= 1UL << class;
   }
   // If the free list is not empty, add the block to the front of the free list
   else {
-    struct free_node *next = first_free;
-    pack_free(next, f, next->next);
-    pack_free(f, NULL, next);
-    first_free = f;
+    pack_free(f, NULL, free_lists[class]);
   }
+  free_lists[class] = f;
 }
 
 /*
- * remove_free - Remove a free block from the free list.
+ * remove_free - Remove a free block from the free list of its size class.
+ * If the block belongs in the tree it is removed from the tree instead.
  * If the block is the first free block, the first free block pointer is updated to the next block.
+ * If the free list becomes empty the class is marked as empty.
  */
 void remove_free(void *f) {
+  // If the block is large, remove it from the tree and the idle list
+  if (GET_BLOCK(GET_HEADER(f)) >= TREE_THRESHOLD) {
+    remove_idle(f);
+    free_tree = tree_remove(free_tree, f);
+    if (free_tree == NULL) {
+      free_classes &= ~(1UL << TREE_CLASS);
+    }
+    return;
+  }
+
   struct free_node *prev = GET_PREV_FREE(f);
   struct free_node *next = GET_NEXT_FREE(f);
   if (prev != NULL) {
@@ -335,9 +2116,378 @@ void remove_free(void *f) {
   if (next != NULL) {
     next->prev = prev;
   }
-  if (first_free == f) {
-    first_free = next;
+  if (prev == NULL) {
+    int class = GET_CLASS(GET_BLOCK(GET_HEADER(f)));
+    free_lists[class] = next;
+    if (next == NULL) {
+      free_classes &= ~(1UL << class);
+    }
+  }
+}
+
+/*
+ * replace_free - Replace free block f with free block g in the same position of the same free list.
+ * Both blocks must belong to the same size class.
+ */
+void replace_free(void *f, void *g) {
+  pack_free(g, GET_PREV_FREE(f), GET_NEXT_FREE(f));
+  if (IS_FIRST_FREE(g)) {
+    free_lists[GET_CLASS(GET_BLOCK(GET_HEADER(g)))] = g;
+  }
+}
+
+/*
+ * tree_insert - Insert node n into the treap rooted at t and return the new root.
+ * The node is inserted as a leaf by its size and address, and then rotated up while its priority is higher than its parent.
+ */
+struct tree_node *tree_insert(struct tree_node *t, struct tree_node *n) {
+  struct tree_node *child;
+
+  // Insert the node as a leaf
+  if (t == NULL) {
+    n->left = NULL;
+    n->right = NULL;
+    return n;
+  }
+
+  // Insert into the left subtree and rotate right if the priority of the child is higher
+  if (TREE_LESS(n, t)) {
+    child = tree_insert(t->left, n);
+    t->left = child;
+    if (GET_PRIORITY(child) > GET_PRIORITY(t)) {
+      t->left = child->right;
+      child->right = t;
+      return child;
+    }
+  }
+  // Insert into the right subtree and rotate left if the priority of the child is higher
+  else {
+    child = tree_insert(t->right, n);
+    t->right = child;
+    if (GET_PRIORITY(child) > GET_PRIORITY(t)) {
+      t->right = child->left;
+      child->left = t;
+      return child;
+    }
+  }
+  return t;
+}
+
+/*
+ * tree_remove - Remove node n from the treap rooted at t and return the new root.
+ * The node is found by its size and address, and replaced with the merge of its two subtrees.
+ * The size of the block must not have changed since it was inserted.
+ */
+struct tree_node *tree_remove(struct tree_node *t, struct tree_node *n) {
+  if (t == n) {
+    return tree_merge(t->left, t->right);
+  }
+  if (TREE_LESS(n, t)) {
+    t->left = tree_remove(t->left, n);
+  }
+  else {
+    t->right = tree_remove(t->right, n);
+  }
+  return t;
+}
+
+/*
+ * tree_merge - Merge the treaps a and b, where every node in a is less than every node in b, and return the new root.
+ * The root with the higher priority stays the root and the other treap is merged into its inner subtree.
+ */
+struct tree_node *tree_merge(struct tree_node *a, struct tree_node *b) {
+  if (a == NULL) {
+    return b;
+  }
+  if (b == NULL) {
+    return a;
+  }
+  if (GET_PRIORITY(a) > GET_PRIORITY(b)) {
+    a->right = tree_merge(a->right, b);
+    return a;
+  }
+  b->left = tree_merge(a, b->left);
+  return b;
+}
+
+/*
+ * tree_best_fit - Find the smallest free block in the tree that is large enough to fit the requested size.
+ * When several blocks have the same size the one with the lowest address is returned.
+ * If no block is large enough the function will return NULL.
+ */
+struct tree_node *tree_best_fit(size_t size) {
+  struct tree_node *t = free_tree;
+  struct tree_node *best = NULL;
+  #if STATS
+    size_t scan = 0;
+  #endif
+  while (t != NULL) {
+    #if STATS
+      if (++scan > heap_stats.longest_scan) { heap_stats.longest_scan = scan; }
+    #endif
+    if (GET_KEY(t) >= size) {
+      best = t;
+      t = t->left;
+    }
+    else {
+      t = t->right;
+    }
+  }
+  return best;
+}
+
+/*
+ * arena_grow - Allocate an object of "size" bytes, a multiple of 16, that does not fit the current chunk of the arena.
+ * If it fits an empty chunk of ARENA_CHUNK bytes, a new chunk becomes the current chunk and the rest of the old one is left unused.
+ * Otherwise the object gets a chunk of its own, which is put after the current chunk so bumping carries on where it was.
+ */
+void *arena_grow(struct mm_arena *arena, size_t size) {
+  size_t offset = ALIGN(sizeof(struct arena_chunk));
+  struct arena_chunk *c;
+
+  if (threaded) { pthread_mutex_lock(&heap_lock); }
+  c = get_chunk(offset + size);
+  if (threaded) { pthread_mutex_unlock(&heap_lock); }
+  if (c == NULL) {
+    return NULL;
+  }
+
+  if (c->size > ARENA_CHUNK) {
+    c->next = arena->chunks->next;
+    arena->chunks->next = c;
+  }
+  else {
+    c->next = arena->chunks;
+    arena->chunks = c;
+    arena->next = (void*)c + offset + size;
+    arena->end = (void*)c + c->size;
+  }
+  return (void*)c + offset;
+}
+
+/*
+ * get_chunk - Get an arena chunk of at least "size" bytes, and at least ARENA_CHUNK bytes.
+ * A chunk of ARENA_CHUNK bytes is taken from the arena chunk cache if it is not empty, other chunks are mapped through the region cache.
+ * The heap lock must be held.
+ */
+struct arena_chunk *get_chunk(size_t size) {
+  struct arena_chunk *c;
+
+  size = size <= ARENA_CHUNK ? ARENA_CHUNK : PAGE_ALIGN(size);
+  if (size == ARENA_CHUNK && arena_chunks != NULL) {
+    c = arena_chunks;
+    arena_chunks = c->next;
+    arena_chunk_count--;
+  }
+  else {
+    c = map_region(size, &size);
+    if (c == NULL) {
+      return NULL;
+    }
+    c->size = size;
+  }
+  c->next = NULL;
+  STAT_ADD(in_use, c->size);
+  return c;
+}
+
+/*
+ * put_chunk - Give back an arena chunk that is no longer used.
+ * Chunks of ARENA_CHUNK bytes are kept committed in the arena chunk cache while it holds fewer than ARENA_CACHE, the rest are released to the region cache.
+ * The heap lock must be held.
+ */
+void put_chunk(struct arena_chunk *c) {
+  STAT_ADD(in_use, -c->size);
+  if (c->size == ARENA_CHUNK && arena_chunk_count < ARENA_CACHE) {
+    c->next = arena_chunks;
+    arena_chunks = c;
+    arena_chunk_count++;
+    return;
+  }
+  release_region(c, c->size);
+}
+
+/*
+ * slab_malloc - Allocate an object with a payload of "size" bytes from a slab of that size.
+ * The first slab with a free object is used, and the first clear bit of its bitmap is taken.
+ * If every slab is full a new one is mapped, and if the slab table is full the function will return NULL.
+ * A slab that becomes full is removed from the list of its size.
+ */
+void *slab_malloc(size_t size) {
+  int class = GET_SLAB_CLASS(size);
+  struct slab *slab = slabs[class];
+  int word, bit;
+
+  // If every slab is full, map a new one and add it to the list of its size
+  // A page of a retained region from the region cache is used if there is one, otherwise SLAB_BATCH pages are mapped at once
+  // and the slab takes the first of them, the rest go to the region cache where the next slabs split their pages off
+  if (slab == NULL) {
+    size_t pagesize = mem_pagesize();
+    slab = reuse_region(pagesize, pagesize);
+    if (slab == NULL) {
+      size_t batch = SLAB_BATCH * pagesize;
+      slab = map_region(batch, &batch);
+      if (slab == NULL) {
+        return NULL;
+      }
+      release_region((void*)slab + pagesize, batch - pagesize);
+    }
+    // If the slab table is full, give the page back the same way slab_free does
+    if (!insert_slab(slab)) {
+      release_region(slab, pagesize);
+      return NULL;
+    }
+    memset(slab, 0, sizeof(struct slab));
+    slab->size = size;
+    slab->capacity = (mem_pagesize() - ALIGN(sizeof(struct slab))) / size;
+    slabs[class] = slab;
+    slab_counts[class]++;
+  }
+
+  // Find and set the first clear bit
+  for (word = 0; ~slab->bitmap[word] == 0; word++);
+  bit = __builtin_ctzl(~slab->bitmap[word]);
+  slab->bitmap[word] |= 1UL << bit;
+  slab->used++;
+
+  // If the slab is full, remove it from the list
+  if (slab->used == slab->capacity) {
+    slabs[class] = slab->next;
+    if (slab->next != NULL) {
+      slab->next->prev = NULL;
+    }
+  }
+
+  #if DEBUG
+    check_slabs();
+  #endif
+
+  return GET_SLAB_OBJECTS(slab) + (word * 64 + bit) * size;
+}
+
+/*
+ * slab_free - Free the object at pointer p in the given slab.
+ * If the slab was full it is added back to the front of the list of its size.
+ * If the slab becomes empty it is released to the region cache, unless it is the only slab of its size.
+ */
+void slab_free(struct slab *slab, void *p) {
+  int class = GET_SLAB_CLASS(slab->size);
+  int index = (p - GET_SLAB_OBJECTS(slab)) / slab->size;
+
+  // If the slab was full, add it back to the list
+  if (slab->used == slab->capacity) {
+    slab->prev = NULL;
+    slab->next = slabs[class];
+    if (slabs[class] != NULL) {
+      slabs[class]->prev = slab;
+    }
+    slabs[class] = slab;
+  }
+
+  // Clear the bit of the object
+  STAT_ADD(in_use, -slab->size);
+  slab->bitmap[index / 64] &= ~(1UL << (index % 64));
+  slab->used--;
+
+  // If the slab is empty and not the only one of its size, remove it from the list and unmap it
+  if (slab->used == 0 && slab_counts[class] > 1) {
+    if (slab->prev != NULL) {
+      slab->prev->next = slab->next;
+    }
+    else {
+      slabs[class] = slab->next;
+    }
+    if (slab->next != NULL) {
+      slab->next->prev = slab->prev;
+    }
+    slab_counts[class]--;
+    delete_slab(slab);
+    release_region(slab, mem_pagesize());
+  }
+
+  #if DEBUG
+    check_slabs();
+  #endif
+}
+
+/*
+ * find_slab - Find the slab holding the block at pointer p, or return NULL if the block is not in a slab.
+ * The slab table is searched by linear probing from the hash of the page of p until an empty entry is found.
+ * This does not need the heap lock, instead the search is repeated if the table was modified while it was read.
+ */
+struct slab *find_slab(void *p) {
+  struct slab *page = GET_SLAB_PAGE(p);
+  struct slab *found;
+  unsigned long seq;
+  size_t i;
+
+  do {
+    seq = __atomic_load_n(&slab_table_seq, __ATOMIC_ACQUIRE);
+    found = NULL;
+    for (i = GET_SLAB_HASH(page); ; i = (i + 1) & (SLAB_TABLE_SIZE - 1)) {
+      struct slab *entry = __atomic_load_n(&slab_table[i].page, __ATOMIC_RELAXED);
+      if (__atomic_load_n(&slab_table[i].generation, __ATOMIC_RELAXED) != heap_generation) {
+        break;
+      }
+      if (entry == page) {
+        found = page;
+        break;
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&slab_table_seq, __ATOMIC_RELAXED));
+
+  return found;
+}
+
+/*
+ * insert_slab - Insert the given slab page into the slab table.
+ * If the table is three quarters full the slab is not inserted and the function will return 0.
+ * The heap lock must be held.
+ */
+int insert_slab(struct slab *slab) {
+  size_t i;
+
+  if (slab_table_count >= SLAB_TABLE_SIZE / 4 * 3) {
+    return 0;
+  }
+
+  // Mark the table as being written, and take the first empty entry after the hash of the page
+  __atomic_store_n(&slab_table_seq, slab_table_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (i = GET_SLAB_HASH(slab); slab_table[i].generation == heap_generation; i = (i + 1) & (SLAB_TABLE_SIZE - 1));
+  __atomic_store_n(&slab_table[i].page, slab, __ATOMIC_RELAXED);
+  __atomic_store_n(&slab_table[i].generation, heap_generation, __ATOMIC_RELAXED);
+  slab_table_count++;
+  __atomic_store_n(&slab_table_seq, slab_table_seq + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+/*
+ * delete_slab - Delete the given slab page from the slab table.
+ * Entries after it are shifted back into the gap so no search would stop early at the removed entry.
+ * The heap lock must be held.
+ */
+void delete_slab(struct slab *slab) {
+  size_t i, j, home;
+
+  // Mark the table as being written, and find the entry of the page
+  __atomic_store_n(&slab_table_seq, slab_table_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (i = GET_SLAB_HASH(slab); slab_table[i].page != slab; i = (i + 1) & (SLAB_TABLE_SIZE - 1));
+
+  // Move any later entry of the same run whose hash is not between the gap and itself into the gap
+  for (j = (i + 1) & (SLAB_TABLE_SIZE - 1); slab_table[j].generation == heap_generation; j = (j + 1) & (SLAB_TABLE_SIZE - 1)) {
+    home = GET_SLAB_HASH(slab_table[j].page);
+    if (((j - home) & (SLAB_TABLE_SIZE - 1)) >= ((j - i) & (SLAB_TABLE_SIZE - 1))) {
+      __atomic_store_n(&slab_table[i].page, slab_table[j].page, __ATOMIC_RELAXED);
+      i = j;
+    }
   }
+  __atomic_store_n(&slab_table[i].generation, 0, __ATOMIC_RELAXED);
+  slab_table_count--;
+  __atomic_store_n(&slab_table_seq, slab_table_seq + 1, __ATOMIC_RELEASE);
 }
 
 /********************************************************
@@ -346,138 +2496,265 @@ void remove_free(void *f) {
 
  /*
   * check_implicit_list - Check the implicit list for errors.
-  * This function checks if the size is misaligned and if the previous and next pointers are correct.
-  * It also checks if there are two consecutive free blocks moving forward or backward.
+  * This function checks if the size is misaligned or too small, and if the previous allocated bits and footers are correct.
+  * It also checks if there are two consecutive free blocks, and if any block on a quick list is not marked allocated.
   * It checks this by iterativly progressing through the list from block p to the end of the list.
-  * It will then iterativly progress through the list from the end to the beginning.
-  * Finally it will iterativly progress through the list from the beginning to block p.
+  * The list can not be followed backward, since only free blocks have a footer, so the blocks before p are checked through the free lists instead.
   */
 void check_implicit_list(void *p) {
   struct header *h = GET_HEADER(p);
-  struct header *start = h;
 
   // Progress from p to the end of the list
-  void *prev = h;
+  struct header *prev = h;
   h = GET_NEXT(h);
-  while (h->sizeForward != 0) {
-    if ((h->sizeForward & ~0xf) % 16 != 0) {
+  while (!IS_TERMINATOR(h)) {
+    if (GET_BLOCK(h) % 16 != 0) {
       printf("Error: sizeForward is not aligned to 16 bytes\n\tp: %p, prev: %p\n", h, prev);
     }
-    if (GET_PREV(h) != prev) {
-      printf("Error: previous pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
+    if (GET_BLOCK(h) < MIN_BLOCK) {
+      printf("Error: block is smaller than the minimum block\n\tp: %p, prev: %p\n", h, prev);
+    }
+    if (IS_SENTINEL(h)) {
+      printf("Error: sentinel in the middle of the list\n\tp: %p, prev: %p\n", h, prev);
     }
     if (!GET_ALLOC(prev) && !GET_ALLOC(h)) {
       printf("Error: two consecutive free blocks moving forward\n\tp: %p, prev: %p\n", h, prev);
     }
+    if (IS_QUICK(h) && !GET_ALLOC(h)) {
+      printf("Error: quick block is not marked allocated\n\tp: %p, prev: %p\n", h, prev);
+    }
+    check_implicit_cycle(GET_PAYLOAD(prev));
     prev = h;
     h = GET_NEXT(h);
   }
-  if (GET_PREV(h) != prev) {
-    printf("Error: previous pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
+  check_implicit_cycle(GET_PAYLOAD(prev));
+  if (!GET_ALLOC(h)) {
+    printf("Error: terminator is not marked allocated\n\tp: %p, prev: %p\n", h, prev);
   }
+}
 
-  // Progress from the end of the list to the beginning
-  prev = h;
-  h = GET_PREV(h);
-  while (h->sizeReverse != 0) {
-    if (h->sizeReverse % 16 != 0) {
-      printf("Error: sizeReverse is not aligned to 16 bytes\n\tp: %p, prev: %p\n", h, prev);
-    }
-    if (GET_NEXT(h) != prev) {
-      printf("Error: next pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
-    }
-    if (((struct header*)prev)->sizeForward != 0 && !GET_ALLOC(h) && !GET_ALLOC(prev)) {
-      printf("Error: two consecutive free blocks moving backward\n\tp: %p, prev: %p\n", h, prev);
-    }
-    prev = h;
-    h = GET_PREV(h);
+/*
+ * check_implicit_cycle - Check the boundary tags between the block at p and its neighbours.
+ * This function checks if the previous allocated bit of the next block matches the current block.
+ * If the current block is free it checks that its footer matches its header, so the next block leads back to it.
+ * If the previous block is free it checks that the previous block leads forward to the current block.
+ */
+void check_implicit_cycle(void *p) {
+  struct header *h = GET_HEADER(p);
+  struct header *next = GET_NEXT(h);
+
+  // Check the next block
+  if (!GET_PREV_ALLOC(next) != !GET_ALLOC(h)) {
+    printf("Error: previous allocated bit does not match the previous block\n\tp: %p\n", next);
   }
-  if (GET_NEXT(h) != prev) {
-    printf("Error: next pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
+  if (!GET_ALLOC(h) && GET_PREV(next) != h) {
+    printf("Error: implicit list is not forward circular\n\tp: %p\n", h);
   }
 
-  // Progress from the beginning of the list to block p
-  if (h == start) {
-    return;
+  // Check the previous block
+  if (IS_SENTINEL(h) && !GET_PREV_ALLOC(h)) {
+    printf("Error: sentinel does not count its previous block as allocated\n\tp: %p\n", h);
   }
-  prev = h;
-  h = GET_NEXT(h);
-  while (h != start) {
-    if (h->sizeForward == 0) {
-      printf("Error: sizeForward is 0\n\tp: %p, prev: %p\n", h, prev);
-      exit(1);
+  if (!GET_PREV_ALLOC(h) && GET_NEXT(GET_PREV(h)) != h) {
+    printf("Error: implicit list is not backward circular\n\tp: %p\n", h);
+  }
+}
+
+/*
+ * check_explicit_list - Check the segregated free lists for errors.
+ * This function checks if the next and previous pointers are correct.
+ * It does this by iterativly progressing from the start of each list to the end of the list.
+ * It then progresses iterativly from the end of the list to the beginning.
+ * It also checks that every block is free with matching boundary tags, is in the list of its size class, and that the class bitmap is correct.
+ * Finally it checks the best fit tree.
+ */
+void check_explicit_list() {
+  int class;
+  if (((free_classes >> TREE_CLASS) & 1) != (free_tree != NULL)) {
+    printf("Error: class bitmap does not match free tree\n");
+  }
+  check_tree(free_tree, NULL, NULL);
+  check_idle_list();
+
+  for (class = 0; class < NUM_CLASSES; class++) {
+    if (((free_classes >> class) & 1) != (free_lists[class] != NULL)) {
+      printf("Error: class bitmap does not match free list\n\tclass: %d\n", class);
     }
-    if ((h->sizeForward & ~0xf) % 16 != 0) {
-      printf("Error: sizeForward is not aligned to 16 bytes\n\tp: %p, prev: %p\n", h, prev);
+    if (free_lists[class] == NULL) {
+      continue;
     }
-    if (GET_PREV(h) != prev) {
-      printf("Error: previous pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
+
+    // Progress from the start of the list to the end of the list
+    struct free_node *prev = NULL;
+    struct free_node *next = (struct free_node*)free_lists[class];
+    while (next != NULL) {
+      if (GET_PREV_FREE(next) != prev) {
+        printf("Error: previous pointer does not point to the correct block\n\tnext: %p, prev: %p\n", next, prev);
+      }
+      if (GET_ALLOC(GET_HEADER(next))) {
+        printf("Error: allocated block in free list\n\tf: %p\n", next);
+      }
+      check_implicit_cycle(next);
+      if (GET_CLASS(GET_BLOCK(GET_HEADER(next))) != class) {
+        printf("Error: block is in the wrong size class\n\tf: %p, class: %d\n", next, class);
+      }
+      prev = next;
+      next = GET_NEXT_FREE(next);
     }
-    if (!GET_ALLOC(prev) && !GET_ALLOC(h)) {
-      printf("Error: two consecutive free blocks moving forward\n\tp: %p, prev: %p\n", h, prev);
+
+    // Progress from the end of the list to the beginning
+    next = GET_PREV_FREE(prev);
+    while (next != NULL) {
+      if (GET_NEXT_FREE(next) != prev) {
+        printf("Error: next pointer does not point to the correct block\n\tnext: %p, prev: %p\n", next, prev);
+      }
+      prev = next;
+      next = GET_PREV_FREE(next);
     }
-    prev = h;
-    h = GET_NEXT(h);
-  }
-  if (GET_PREV(h) != prev) {
-    printf("Error: previous pointer does not point to the correct block\n\tp: %p, prev: %p\n", h, prev);
   }
 }
 
 /*
- * check_implicit_cycle - Check the implicit list for circularity.
- * This function checks if the previous pointer of the next block is the same as the current block.
- * It also checks if the next pointer of the previous block is the same as the current block.
+ * check_tree - Check the best fit tree for errors.
+ * This function checks that every node in the subtree t lies between the nodes low and high, which may be NULL.
+ * It also checks that no child has a higher priority than its parent, and that every node is free with matching boundary tags and large enough.
+ * It does this by recursivly checking the left and right subtrees.
  */
-void check_implicit_cycle(void *p) {
-  struct header *h = GET_HEADER(p);
-  struct header *start = h;
+void check_tree(struct tree_node *t, struct tree_node *low, struct tree_node *high) {
+  if (t == NULL) {
+    return;
+  }
+  if ((low != NULL && !TREE_LESS(low, t)) || (high != NULL && !TREE_LESS(t, high))) {
+    printf("Error: tree node is out of order\n\tt: %p, low: %p, high: %p\n", t, low, high);
+  }
+  if ((t->left != NULL && GET_PRIORITY(t->left) > GET_PRIORITY(t)) || (t->right != NULL && GET_PRIORITY(t->right) > GET_PRIORITY(t))) {
+    printf("Error: tree child has a higher priority than its parent\n\tt: %p\n", t);
+  }
+  if (GET_ALLOC(GET_HEADER(t))) {
+    printf("Error: allocated block in tree\n\tt: %p\n", t);
+  }
+  check_implicit_cycle(t);
+  if (GET_KEY(t) < TREE_THRESHOLD) {
+    printf("Error: block in tree is too small\n\tt: %p, size: %ld\n", t, GET_KEY(t));
+  }
+  check_tree(t->left, low, t);
+  check_tree(t->right, t, high);
+}
 
-  // Check the previous pointer of the next block
-  h = GET_PREV(GET_NEXT(h));
-  if (h != start) {
-    printf("Error: implicit list is not forward circular\n\tp: %p\n", h);
+/*
+ * check_idle_list - Check the idle list for errors.
+ * This function checks that every block on it is a free tree block that is not decommitted, that its links match, and that the list is oldest first.
+ */
+void check_idle_list() {
+  struct tree_node *prev = NULL;
+  struct tree_node *t;
+  for (t = idle_head; t != NULL; prev = t, t = t->idle_next) {
+    if (!t->idle || t->idle_prev != prev) {
+      printf("Error: idle list is not linked correctly\n\tt: %p, prev: %p\n", t, prev);
+    }
+    if (GET_ALLOC(GET_HEADER(t)) || GET_KEY(t) < TREE_THRESHOLD || t->decommitted) {
+      printf("Error: block on idle list is not a committed free tree block\n\tt: %p\n", t);
+    }
+    if (prev != NULL && prev->idle_pass > t->idle_pass) {
+      printf("Error: idle list is out of order\n\tt: %p, prev: %p\n", t, prev);
+    }
   }
+  if (idle_tail != prev) {
+    printf("Error: idle list tail does not point to its last block\n\ttail: %p, last: %p\n", idle_tail, prev);
+  }
+}
 
-  // Check the next pointer of the previous block
-  if (!IS_SENTINEL(h)) {
-    h = GET_NEXT(GET_PREV(h));
-    if (h != start) {
-      printf("Error: implicit list is not backward circular\n\tp: %p\n", h);
+/*
+ * check_slabs - Check the slabs for errors.
+ * This function checks that every slab in the list of each size has the right size, and can be found in the slab table.
+ * It also checks that the used count matches the bitmap, and that no slab in a list is full.
+ */
+void check_slabs() {
+  int class, word, bits;
+  for (class = 0; class < SLAB_CLASSES; class++) {
+    struct slab *slab;
+    for (slab = slabs[class]; slab != NULL; slab = slab->next) {
+      if (slab->size != (class + 1) * ALIGNMENT) {
+        printf("Error: slab is in the list of the wrong size\n\tslab: %p, size: %ld\n", slab, slab->size);
+      }
+      if (find_slab(GET_SLAB_OBJECTS(slab)) != slab) {
+        printf("Error: slab is not in the slab table\n\tslab: %p\n", slab);
+      }
+      for (word = 0, bits = 0; word < SLAB_WORDS; word++) {
+        bits += __builtin_popcountl(slab->bitmap[word]);
+      }
+      if (bits != slab->used) {
+        printf("Error: slab used count does not match its bitmap\n\tslab: %p, used: %d, bits: %d\n", slab, slab->used, bits);
+      }
+      if (slab->used >= slab->capacity) {
+        printf("Error: full slab in list\n\tslab: %p\n", slab);
+      }
+      if (slab->next != NULL && slab->next->prev != slab) {
+        printf("Error: slab list is not circular\n\tslab: %p\n", slab);
+      }
     }
   }
 }
 
 /*
- * check_explicit_list - Check the explicit free list for errors.
- * This function checks if the next and previous pointers are correct.
- * It does this by iterativly progressing from the start of the list to the end of the list.
- * It then progresses iterativly from the end of the list to the beginning.
+ * check_regions - Check the region cache for errors.
+ * This function checks that every retained region is in the bucket of its page count and that the retained page count is correct.
+ * It also checks that the release order links the same regions, oldest first.
  */
-void check_explicit_list() {
-  if (first_free == NULL) {
-    return;
+void check_regions() {
+  size_t pages = 0;
+  int bucket;
+  for (bucket = 0; bucket < RETAIN_BUCKETS; bucket++) {
+    struct retained_region *r;
+    for (r = retained[bucket]; r != NULL; r = r->next) {
+      if (r->size != (bucket + 1) * mem_pagesize()) {
+        printf("Error: retained region is in the bucket of the wrong size\n\tr: %p, size: %ld\n", r, r->size);
+      }
+      if ((r == retained[bucket]) != (r->prev == NULL) || (r->prev != NULL && r->prev->next != r)) {
+        printf("Error: retained region is not linked correctly in its bucket\n\tr: %p\n", r);
+      }
+      pages += bucket + 1;
+    }
+  }
+  if (pages != retained_pages) {
+    printf("Error: retained page count does not match the region cache\n\tcount: %ld, pages: %ld\n", retained_pages, pages);
   }
 
-  // Progress from the start of the list to the end of the list
-  struct free_node *prev = (struct free_node*)first_free;
-  struct free_node *next = GET_NEXT_FREE(prev);
-  while (next != NULL) {
-    if (GET_PREV_FREE(next) != prev) {
-      printf("Error: previous pointer does not point to the correct block\n\tnext: %p, prev: %p\n", next, prev);
+  // The release order must hold the same regions, oldest first
+  struct retained_region *r, *older = NULL;
+  for (r = oldest_region; r != NULL; older = r, r = r->newer) {
+    if (r->older != older || (older != NULL && older->stamp > r->stamp)) {
+      printf("Error: retained regions are not in release order\n\tr: %p, older: %p\n", r, older);
     }
-    prev = next;
-    next = GET_NEXT_FREE(next);
+    pages -= r->size / mem_pagesize();
+  }
+  if (newest_region != older || pages != 0) {
+    printf("Error: release order does not match the region cache\n\tnewest: %p, last: %p\n", newest_region, older);
   }
+}
 
-  // Progress from the end of the list to the beginning
-  next = GET_PREV_FREE(prev);
-  while (next != NULL) {
-    if (GET_NEXT_FREE(next) != prev) {
-      printf("Error: next pointer does not point to the correct block\n\tnext: %p, prev: %p\n", next, prev);
+/*
+ * check_quick_lists - Check that every block on a quick list is marked QUICK and allocated, is on the list of its size, and that the counts match the lists.
+ */
+void check_quick_lists() {
+  int bin, count, total = 0;
+  for (bin = 0; bin < QUICK_BINS; bin++) {
+    void *p;
+    for (p = quick_lists[bin], count = 0; p != NULL; p = GET_NEXT_FREE(p), count++) {
+      if (!IS_QUICK(GET_HEADER(p)) || !GET_ALLOC(GET_HEADER(p))) {
+        printf("Error: block on a quick list is not marked quick and allocated\n\tp: %p\n", p);
+      }
+      if (GET_QUICK_BIN(GET_BLOCK(GET_HEADER(p))) != bin) {
+        printf("Error: block is on the quick list of the wrong size\n\tp: %p, bin: %d\n", p, bin);
+      }
+    }
+    if (count != quick_counts[bin]) {
+      printf("Error: quick list count does not match its list\n\tbin: %d, count: %d, blocks: %d\n", bin, quick_counts[bin], count);
     }
-    prev = next;
-    next = GET_PREV_FREE(next);
+    total += count;
+  }
+  if (total != quick_total) {
+    printf("Error: quick list total does not match the lists\n\ttotal: %d, blocks: %d\n", quick_total, total);
   }
 }
 
@@ -504,4 +2781,34 @@ void check_explicit_cycle(void *f) {
       printf("Error: explicit list is not backward circular\n\tf: %p\n", f);
     }
   }
-}
\ No newline at end of file
+}
+
+/**********************************************************
+ * Statistics Functions
+ **********************************************************/
+
+/*
+ * stats_count_free - Count the free block at payload pointer f in the free block fields of stats.
+ */
+void stats_count_free(struct mm_stats *stats, void *f) {
+  size_t size = GET_BLOCK(GET_HEADER(f));
+  int bucket = LOG2(size >> 5);
+  if (bucket >= MM_STATS_BUCKETS) {
+    bucket = MM_STATS_BUCKETS - 1;
+  }
+  stats->free += size;
+  stats->free_blocks++;
+  stats->free_histogram[bucket]++;
+}
+
+/*
+ * stats_count_tree - Count every free block in the tree rooted at t in the free block fields of stats.
+ */
+void stats_count_tree(struct mm_stats *stats, struct tree_node *t) {
+  if (t == NULL) {
+    return;
+  }
+  stats_count_free(stats, t);
+  stats_count_tree(stats, t->left);
+  stats_count_tree(stats, t->right);
+}
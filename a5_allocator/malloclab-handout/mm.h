@@ -3,3 +3,40 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized (void *ptr, size_t size);
+extern void *mm_realloc (void *ptr, size_t size);
+extern void mm_set_threaded (int enable);
+extern void mm_set_growth (size_t min, size_t max);
+extern void mm_set_decommit (int enable);
+extern void *mm_memalign (size_t align, size_t size);
+extern size_t mm_usable_size (void *ptr);
+extern size_t mm_malloc_batch (size_t size, size_t n, void **ptrs);
+/* Frees the n blocks in ptrs, reordering and overwriting ptrs as it goes */
+extern void mm_free_batch (size_t n, void **ptrs);
+
+/* An arena, whose objects are bumped out of chunks and freed all at once */
+struct mm_arena;
+
+extern struct mm_arena *mm_arena_create (void);
+extern void *mm_arena_alloc (struct mm_arena *arena, size_t size);
+extern void mm_arena_reset (struct mm_arena *arena);
+extern void mm_arena_destroy (struct mm_arena *arena);
+
+/* Number of buckets in the free block histogram, bucket i counts blocks of [32*2^i, 32*2^(i+1)) bytes and the last one all larger blocks */
+#define MM_STATS_BUCKETS 16
+
+/* Statistics of the heap, filled in by mm_stats */
+struct mm_stats {
+  size_t in_use;          /* bytes of allocated blocks, including headers, slab objects, huge blocks, blocks held by thread caches and quick lists, and arena chunks */
+  size_t free;            /* bytes of free blocks in the free lists and tree */
+  size_t free_blocks;     /* number of free blocks in the free lists and tree */
+  size_t free_histogram[MM_STATS_BUCKETS]; /* number of free blocks by size */
+  size_t retained;        /* bytes of regions held by the region cache and chunks held by the arena chunk cache */
+  size_t longest_scan;    /* most free blocks looked at by one search for a fit */
+  size_t splits;          /* free blocks split to allocate part of them, and allocated blocks split to shrink them */
+  size_t coalesces;       /* free blocks merged with a free neighbour */
+  size_t maps;            /* mappings made with mem_map */
+  size_t unmaps;          /* mappings given back with mem_unmap */
+};
+
+extern void mm_stats (struct mm_stats *stats);
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <sys/mman.h>
 #include "pagemap.h"
 
 /* Keep track of all mapped pages so that we can easily get a list of
@@ -9,10 +10,23 @@
 typedef struct mpage {
   void *addr;
   struct mpage *prev, *next;
+  int decommitted; /* mapped, but its memory was given back by mem_decommit */
 } mpage;
 
 static mpage *all_mapped_pages;
 
+/* The tables are mapped directly instead of calloc'd, so that the
+   allocator can track its pages while it is the process malloc. */
+static void *table_alloc(size_t count, size_t size) {
+  void *p = mmap(0, count * size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "internal error: cannot map page table\n");
+    abort();
+  }
+  return p;
+}
+
 static mpage ***page_maps1;
 
 #define PAGEMAP64_LEVEL1_SIZE (1 << 16)
@@ -29,20 +43,20 @@ void pagemap_modify(void *p, int mapped) {
   mpage *page;
 
   if (!page_maps1) {
-    page_maps1 = calloc(PAGEMAP64_LEVEL1_SIZE, sizeof(mpage **));
+    page_maps1 = table_alloc(PAGEMAP64_LEVEL1_SIZE, sizeof(mpage **));
   }
 
   pos = PAGEMAP64_LEVEL1_BITS(p);
   page_maps2 = page_maps1[pos];
   if (!page_maps2) {
-    page_maps2 = calloc(PAGEMAP64_LEVEL2_SIZE, sizeof(mpage *));
+    page_maps2 = table_alloc(PAGEMAP64_LEVEL2_SIZE, sizeof(mpage *));
     page_maps1[pos] = page_maps2;
   }
   
   pos = PAGEMAP64_LEVEL2_BITS(p);
   page_maps3 = page_maps2[pos];
   if (!page_maps3) {
-    page_maps3 = calloc(PAGEMAP64_LEVEL3_SIZE, sizeof(mpage));
+    page_maps3 = table_alloc(PAGEMAP64_LEVEL3_SIZE, sizeof(mpage));
     page_maps2[pos] = page_maps3;
   }
 
@@ -56,6 +70,7 @@ void pagemap_modify(void *p, int mapped) {
     if (page == all_mapped_pages)
       abort();
     page->addr = p;
+    page->decommitted = 0;
     page->prev = NULL;
     page->next = all_mapped_pages;
     if (all_mapped_pages)
@@ -88,6 +103,34 @@ int pagemap_is_mapped(void *p) {
   return !!page_maps3[PAGEMAP64_LEVEL3_BITS(p)].addr;
 }
 
+static mpage *find_page(void *p) {
+  mpage **page_maps2;
+  mpage *page_maps3;
+
+  if (!page_maps1) return NULL;
+  page_maps2 = page_maps1[PAGEMAP64_LEVEL1_BITS(p)];
+  if (!page_maps2) return NULL;
+  page_maps3 = page_maps2[PAGEMAP64_LEVEL2_BITS(p)];
+  if (!page_maps3) return NULL;
+  return &page_maps3[PAGEMAP64_LEVEL3_BITS(p)];
+}
+
+void pagemap_set_decommitted(void *p, int decommitted) {
+  mpage *page = find_page(p);
+
+  if (!page || !page->addr) {
+    fprintf(stderr, "internal error: not currently mapped\n");
+    abort();
+  }
+  page->decommitted = decommitted;
+}
+
+int pagemap_is_decommitted(void *p) {
+  mpage *page = find_page(p);
+
+  return page && page->addr && page->decommitted;
+}
+
 void pagemap_for_each(page_callback f) {
   mpage *p, *next;
   p = all_mapped_pages;
@@ -3,6 +3,8 @@ typedef void (*page_callback)(void *addr);
 
 void pagemap_modify(void *addr, int mapped);
 int pagemap_is_mapped(void *addr);
+void pagemap_set_decommitted(void *addr, int decommitted);
+int pagemap_is_decommitted(void *addr);
 void pagemap_for_each(page_callback f);
 
 /* APAGE_SIZE needs to match the actual page size */
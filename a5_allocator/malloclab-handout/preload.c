@@ -0,0 +1,172 @@
+/*
+ * preload.c - runs mm.c as the malloc of any program
+ *
+ * Built into libmm.so together with mm.c, memlib.c and pagemap.c:
+ *
+ *   unix> LD_PRELOAD=./libmm.so sort big.txt
+ *
+ * Every allocation function of the C library is replaced, and nothing
+ * is forwarded to the C library's malloc. So the shim never needs
+ * dlsym to find it, and the allocations that dlsym and the dynamic
+ * loader make are served by mm.c like any other. The heap is set up by
+ * the first call, whenever that happens, and always runs in the
+ * thread-safe mode since the program may start threads at any time.
+ * It also decommits the idle pages of large free blocks, since a real
+ * program may hold on to a large free block for a long time.
+ *
+ * Pointers that are not in a page mapped by memlib, such as blocks the
+ * dynamic loader allocated before the shim was loaded, are ignored by
+ * free. realloc can not know how large such a block is, so it fails.
+ *
+ * A request that is too large, or that memory runs out for, returns
+ * NULL with errno set to ENOMEM, as the C library's malloc does.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "pagemap.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int initialized;
+
+static void init(void)
+{
+  mem_init();
+  mm_set_threaded(1);
+  mm_set_decommit(1);
+  mm_init();
+  initialized = 1;
+}
+
+/* Set up the heap if this is the first call */
+static inline void ensure_init(void)
+{
+  if (!initialized)
+    pthread_once(&init_once, init);
+}
+
+/* Is p a block of ours, as opposed to one from before the shim was loaded */
+static inline int is_ours(void *p)
+{
+  return pagemap_is_mapped(p);
+}
+
+EXPORT void *malloc(size_t size)
+{
+  void *p;
+
+  ensure_init();
+  if ((p = mm_malloc(size)) == NULL)
+    errno = ENOMEM;
+  return p;
+}
+
+EXPORT void free(void *p)
+{
+  if (p == NULL || !is_ours(p))
+    return;
+  mm_free(p);
+}
+
+/* C23 sized free; the block is found by address, so the size is only passed along */
+EXPORT void free_sized(void *p, size_t size)
+{
+  if (p == NULL || !is_ours(p))
+    return;
+  mm_free_sized(p, size);
+}
+
+/* An aligned block can be larger than its size says, so it is freed by address */
+EXPORT void free_aligned_sized(void *p, size_t align, size_t size)
+{
+  free(p);
+}
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+  void *p;
+
+  if (size != 0 && n > (size_t)-1 / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ensure_init();
+  if ((p = mm_malloc(n * size)) == NULL)
+    errno = ENOMEM;
+  else
+    memset(p, 0, n * size);
+  return p;
+}
+
+EXPORT void *realloc(void *p, size_t size)
+{
+  void *newp;
+
+  if (p != NULL && !is_ours(p)) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ensure_init();
+  if ((newp = mm_realloc(p, size)) == NULL && size != 0)
+    errno = ENOMEM;
+  return newp;
+}
+
+EXPORT int posix_memalign(void **result, size_t align, size_t size)
+{
+  void *p;
+
+  if (align == 0 || (align & (align - 1)) || align % sizeof(void *))
+    return EINVAL;
+  ensure_init();
+  if ((p = mm_memalign(align, size)) == NULL)
+    return ENOMEM;
+  *result = p;
+  return 0;
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+  void *p;
+
+  if (align == 0 || (align & (align - 1))) {
+    errno = EINVAL;
+    return NULL;
+  }
+  ensure_init();
+  if ((p = mm_memalign(align, size)) == NULL)
+    errno = ENOMEM;
+  return p;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+  return memalign(align, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+  return memalign(APAGE_SIZE, size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+  if (size > (size_t)-1 - APAGE_SIZE) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return memalign(APAGE_SIZE, (size + APAGE_SIZE - 1) & ~(size_t)(APAGE_SIZE - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *p)
+{
+  if (p == NULL || !is_ours(p))
+    return 0;
+  return mm_usable_size(p);
+}
@@ -0,0 +1,258 @@
+/*
+ * rec2rep - convert a log written by librecord.so into a trace file
+ *
+ * The records are sorted into the order their requests were made in,
+ * and every block gets a dense id in the order it was allocated. A
+ * reallocated block keeps its id. Requests mdriver can not replay are
+ * dropped: failed allocations, frees of blocks allocated before the
+ * log started, and allocations of more than INT_MAX bytes. Zero-byte
+ * allocations become one-byte allocations, since they still return a
+ * block, and realloc to zero bytes becomes a free.
+ *
+ * usage: rec2rep [-b] <log> > <trace>
+ *   -b  free the blocks still allocated at the end, which gives a
+ *       balanced trace
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "record.h"
+
+/* A request of the trace */
+typedef struct {
+    char type;      /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+} op_t;
+
+/* Open addressing table from the address of a live block to its id */
+typedef struct {
+    uint64_t ptr;   /* 0 if the slot is empty */
+    int id;
+} slot_t;
+
+static slot_t *table;
+static size_t table_size, table_count;
+
+static op_t *ops;
+static size_t num_ops, max_ops;
+static int num_ids, max_ids;
+static size_t *sizes;       /* current size of each id, 0 once it is freed */
+static size_t live, peak;   /* bytes allocated now, and at most */
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+#define HASH(ptr) (((ptr) >> 4) * 0x9E3779B97F4A7C15UL)
+
+static slot_t *find_slot(slot_t *t, size_t n, uint64_t ptr)
+{
+    size_t i;
+
+    for (i = HASH(ptr) & (n - 1); t[i].ptr != 0 && t[i].ptr != ptr; i = (i + 1) & (n - 1));
+    return &t[i];
+}
+
+/* Return the id of the live block at ptr, or -1 */
+static int lookup(uint64_t ptr)
+{
+    slot_t *s;
+
+    if (table_size == 0)
+	return -1;
+    s = find_slot(table, table_size, ptr);
+    return s->ptr == ptr ? s->id : -1;
+}
+
+static void insert(uint64_t ptr, int id)
+{
+    size_t i;
+
+    if (2 * (table_count + 1) > table_size) {
+	size_t n = table_size ? 2 * table_size : 1024;
+	slot_t *t = calloc(n, sizeof(slot_t));
+	if (t == NULL)
+	    unix_error("calloc failed in insert");
+	for (i = 0; i < table_size; i++)
+	    if (table[i].ptr != 0)
+		*find_slot(t, n, table[i].ptr) = table[i];
+	free(table);
+	table = t;
+	table_size = n;
+    }
+    *find_slot(table, table_size, ptr) = (slot_t){ptr, id};
+    table_count++;
+}
+
+/* Remove ptr, moving later slots of its run back so lookups still find them */
+static void remove_ptr(uint64_t ptr)
+{
+    size_t i = find_slot(table, table_size, ptr) - table, j, k;
+
+    table[i].ptr = 0;
+    table_count--;
+    for (j = (i + 1) & (table_size - 1); table[j].ptr != 0; j = (j + 1) & (table_size - 1)) {
+	k = HASH(table[j].ptr) & (table_size - 1);
+	if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+	    table[i] = table[j];
+	    table[j].ptr = 0;
+	    i = j;
+	}
+    }
+}
+
+static void emit(char type, int id, size_t size)
+{
+    if (num_ops == max_ops) {
+	max_ops = max_ops ? 2 * max_ops : 4096;
+	if ((ops = realloc(ops, max_ops * sizeof(op_t))) == NULL)
+	    unix_error("realloc failed in emit");
+    }
+    ops[num_ops++] = (op_t){type, id, size};
+
+    if (type == 'f') {
+	live -= sizes[id];
+	sizes[id] = 0;
+    } else {
+	live += size - sizes[id];
+	sizes[id] = size;
+    }
+    if (live > peak)
+	peak = live;
+}
+
+static void do_free(uint64_t ptr)
+{
+    int id = lookup(ptr);
+
+    if (id < 0)
+	return;
+    remove_ptr(ptr);
+    emit('f', id, 0);
+}
+
+static void do_alloc(uint64_t ptr, uint64_t size)
+{
+    if (ptr == 0 || size > INT_MAX)
+	return;
+
+    /* Another thread's free of this block may have been ordered after
+       its allocation here, so free the old block first */
+    do_free(ptr);
+
+    if (num_ids == max_ids) {
+	max_ids = max_ids ? 2 * max_ids : 4096;
+	if ((sizes = realloc(sizes, max_ids * sizeof(size_t))) == NULL)
+	    unix_error("realloc failed in do_alloc");
+    }
+    sizes[num_ids] = 0;
+    insert(ptr, num_ids);
+    emit('a', num_ids++, size ? size : 1);
+}
+
+static void do_realloc(uint64_t ptr, uint64_t old, uint64_t size)
+{
+    int id;
+
+    if (old == 0) {
+	do_alloc(ptr, size);
+	return;
+    }
+    if (size == 0) {
+	do_free(old);
+	return;
+    }
+    if (ptr == 0 || size > INT_MAX)
+	return;
+    if ((id = lookup(old)) < 0) {
+	do_alloc(ptr, size);
+	return;
+    }
+    remove_ptr(old);
+    do_free(ptr);
+    insert(ptr, id);
+    emit('r', id, size);
+}
+
+static int by_seq(const void *a, const void *b)
+{
+    const rec_t *x = a, *y = b;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f;
+    rec_t *recs;
+    long len;
+    size_t n, i;
+    int c, id, balance = 0;
+
+    while ((c = getopt(argc, argv, "b")) != EOF) {
+	switch (c) {
+	case 'b':
+	    balance = 1;
+	    break;
+	default:
+	    fprintf(stderr, "usage: rec2rep [-b] <log> > <trace>\n");
+	    exit(1);
+	}
+    }
+    if (optind != argc - 1) {
+	fprintf(stderr, "usage: rec2rep [-b] <log> > <trace>\n");
+	exit(1);
+    }
+
+    /* Read the whole log and sort it into request order */
+    if ((f = fopen(argv[optind], "rb")) == NULL)
+	unix_error(argv[optind]);
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    rewind(f);
+    n = len / sizeof(rec_t);
+    if ((recs = malloc(n * sizeof(rec_t) + 1)) == NULL)
+	unix_error("malloc failed in main");
+    if (fread(recs, sizeof(rec_t), n, f) != n)
+	unix_error("fread failed in main");
+    fclose(f);
+    qsort(recs, n, sizeof(rec_t), by_seq);
+
+    for (i = 0; i < n; i++) {
+	switch (recs[i].type) {
+	case REC_ALLOC:
+	    do_alloc(recs[i].ptr, recs[i].size);
+	    break;
+	case REC_REALLOC:
+	    do_realloc(recs[i].ptr, recs[i].old, recs[i].size);
+	    break;
+	case REC_FREE:
+	    do_free(recs[i].ptr);
+	    break;
+	default:
+	    fprintf(stderr, "rec2rep: bad record type %u\n", recs[i].type);
+	    exit(1);
+	}
+    }
+
+    /* Free what is left in id order, so the trace does not depend on addresses */
+    if (balance) {
+	for (id = 0; id < num_ids; id++)
+	    if (sizes[id] != 0)
+		emit('f', id, 0);
+    }
+
+    printf("%zu\n%d\n%zu\n1\n", peak, num_ids, num_ops);
+    for (i = 0; i < num_ops; i++) {
+	if (ops[i].type == 'f')
+	    printf("f %d\n", ops[i].id);
+	else
+	    printf("%c %d %zu\n", ops[i].type, ops[i].id, ops[i].size);
+    }
+    return 0;
+}
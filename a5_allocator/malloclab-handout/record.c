@@ -0,0 +1,255 @@
+/*
+ * record.c - records the allocation requests of any program
+ *
+ * Built into librecord.so:
+ *
+ *   unix> LD_PRELOAD=./librecord.so MM_RECORD=sort sort big.txt
+ *   unix> ./rec2rep sort.<pid>.bin > sort.rep
+ *
+ * Each request is served by the C library's malloc through its
+ * __libc_* entry points, which needs no dlsym, and appended to a
+ * buffer of the calling thread. A full buffer is written to the log
+ * with a single write, so threads only share the sequence counter
+ * that orders their requests. rec2rep turns the log into a trace
+ * (see record.h).
+ *
+ * The log is <prefix>.<pid>.bin, where the prefix is MM_RECORD or
+ * mm_record if that is not set, so every process the program starts
+ * writes a log of its own. A child made by fork drops the records it
+ * inherited buffered, which are left for the parent to write.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "record.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+/* Records buffered per thread before they are written */
+#define REC_BUFFER 4096
+
+extern void *__libc_malloc(size_t);
+extern void __libc_free(void *);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void *__libc_valloc(size_t);
+extern void *__libc_pvalloc(size_t);
+
+/* The buffer of a thread; buffers of exited threads are reused */
+typedef struct rec_buf {
+  rec_t recs[REC_BUFFER];
+  int count;
+  int active;               /* owned by a running thread */
+  struct rec_buf *next;     /* in the list of all buffers */
+} rec_buf;
+
+static rec_buf *all_bufs;
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buf_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static int log_fd = -1;
+static uint64_t seq;
+
+static __thread rec_buf *buf;
+static __thread int busy;   /* set while the recorder itself may allocate */
+
+/* Open the log the first time it is written */
+static int open_log(void)
+{
+  char path[4096];
+  const char *prefix;
+
+  pthread_mutex_lock(&log_lock);
+  if (log_fd < 0) {
+    if ((prefix = getenv("MM_RECORD")) == NULL)
+      prefix = "mm_record";
+    snprintf(path, sizeof(path), "%s.%d.bin", prefix, (int)getpid());
+    log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  }
+  pthread_mutex_unlock(&log_lock);
+  return log_fd;
+}
+
+static void flush(rec_buf *b)
+{
+  int fd = log_fd >= 0 ? log_fd : open_log();
+
+  if (b->count > 0 && fd >= 0)
+    write(fd, b->recs, b->count * sizeof(rec_t));
+  b->count = 0;
+}
+
+/* Write out the buffer of an exiting thread and give it up */
+static void release_buf(void *p)
+{
+  rec_buf *b = p;
+
+  busy = 1;
+  flush(b);
+  b->active = 0;
+  buf = NULL;
+  busy = 0;
+}
+
+static void make_key(void)
+{
+  pthread_key_create(&buf_key, release_buf);
+}
+
+/* Find the calling thread a buffer, reusing one of an exited thread */
+static rec_buf *get_buf(void)
+{
+  rec_buf *b;
+
+  busy = 1;
+  pthread_mutex_lock(&bufs_lock);
+  for (b = all_bufs; b != NULL && b->active; b = b->next);
+  if (b == NULL) {
+    b = mmap(0, sizeof(rec_buf), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (b == MAP_FAILED) {
+      pthread_mutex_unlock(&bufs_lock);
+      busy = 0;
+      return NULL;
+    }
+    b->next = all_bufs;
+    all_bufs = b;
+  }
+  b->active = 1;
+  b->count = 0;
+  pthread_mutex_unlock(&bufs_lock);
+
+  pthread_once(&key_once, make_key);
+  pthread_setspecific(buf_key, b);
+  buf = b;
+  busy = 0;
+  return b;
+}
+
+static void record(uint32_t type, void *ptr, void *old, size_t size)
+{
+  rec_buf *b = buf;
+  rec_t *r;
+
+  if (busy || (b == NULL && (b = get_buf()) == NULL))
+    return;
+  r = &b->recs[b->count++];
+  r->seq = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+  r->ptr = (uintptr_t)ptr;
+  r->old = (uintptr_t)old;
+  r->size = size;
+  r->type = type;
+  r->pad = 0;
+  if (b->count == REC_BUFFER) {
+    busy = 1;
+    flush(b);
+    busy = 0;
+  }
+}
+
+/* In a new child, start a log of its own and drop the parent's records */
+static void child_after_fork(void)
+{
+  rec_buf *b;
+
+  if (log_fd >= 0)
+    close(log_fd);
+  log_fd = -1;
+  for (b = all_bufs; b != NULL; b = b->next) {
+    b->count = 0;
+    b->active = (b == buf);
+  }
+}
+
+__attribute__((constructor)) static void start(void)
+{
+  pthread_atfork(NULL, NULL, child_after_fork);
+}
+
+/* Write out every buffer at exit, including those of running threads */
+__attribute__((destructor)) static void finish(void)
+{
+  rec_buf *b;
+
+  busy = 1;
+  pthread_mutex_lock(&bufs_lock);
+  for (b = all_bufs; b != NULL; b = b->next)
+    flush(b);
+  pthread_mutex_unlock(&bufs_lock);
+}
+
+EXPORT void *malloc(size_t size)
+{
+  void *p = __libc_malloc(size);
+  record(REC_ALLOC, p, NULL, size);
+  return p;
+}
+
+/* A free is recorded before the block can be handed out again */
+EXPORT void free(void *p)
+{
+  if (p != NULL)
+    record(REC_FREE, p, NULL, 0);
+  __libc_free(p);
+}
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+  void *p = __libc_calloc(n, size);
+  record(REC_ALLOC, p, NULL, n * size);
+  return p;
+}
+
+EXPORT void *realloc(void *old, size_t size)
+{
+  void *p = __libc_realloc(old, size);
+  record(REC_REALLOC, p, old, size);
+  return p;
+}
+
+/* The aligned allocators are recorded as plain allocations */
+EXPORT void *memalign(size_t align, size_t size)
+{
+  void *p = __libc_memalign(align, size);
+  record(REC_ALLOC, p, NULL, size);
+  return p;
+}
+
+EXPORT int posix_memalign(void **result, size_t align, size_t size)
+{
+  void *p;
+
+  if (align == 0 || (align & (align - 1)) || align % sizeof(void *))
+    return EINVAL;
+  if ((p = memalign(align, size)) == NULL)
+    return ENOMEM;
+  *result = p;
+  return 0;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+  return memalign(align, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+  void *p = __libc_valloc(size);
+  record(REC_ALLOC, p, NULL, size);
+  return p;
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+  void *p = __libc_pvalloc(size);
+  record(REC_ALLOC, p, NULL, size);
+  return p;
+}
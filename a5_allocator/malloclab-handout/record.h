@@ -0,0 +1,23 @@
+/*
+ * record.h - binary log written by librecord.so and read by rec2rep
+ *
+ * The log is a sequence of records in the byte order of the machine
+ * that wrote it. Each thread writes its records in batches, so the
+ * records of different threads are interleaved in the log and have
+ * to be sorted by seq to get the order the requests were made in.
+ */
+#include <stdint.h>
+
+/* Request types */
+#define REC_ALLOC   1  /* malloc, calloc and the aligned allocators */
+#define REC_REALLOC 2
+#define REC_FREE    3
+
+typedef struct {
+    uint64_t seq;   /* order of the request among those of all threads */
+    uint64_t ptr;   /* block returned by an allocation, or given to free */
+    uint64_t old;   /* block given to realloc */
+    uint64_t size;  /* bytes asked for by an allocation */
+    uint32_t type;  /* REC_ALLOC, REC_REALLOC or REC_FREE */
+    uint32_t pad;
+} rec_t;
@@ -0,0 +1,94 @@
+/*
+ * rep2bin - convert a text trace into a binary trace mdriver can map
+ *
+ * usage: rep2bin <trace.rep> <trace.bin>
+ *
+ * The binary trace is described in trace.h. Request ids must fit in
+ * 30 bits and sizes in 32 bits; the ids and the request count are
+ * checked against the header as the text trace is read.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void bad_trace(char *path, unsigned line, char *why)
+{
+    fprintf(stderr, "rep2bin: %s:%u: %s\n", path, line, why);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    trace_header_t hdr;
+    traceop_t op;
+    char type[64];
+    unsigned long index, size;
+    unsigned op_index = 0;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: rep2bin <trace.rep> <trace.bin>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+	unix_error(argv[1]);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    if (fscanf(in, "%u %u %u %u", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	bad_trace(argv[1], 1, "bad header");
+    if (hdr.num_ids > (1U << 30))
+	bad_trace(argv[1], 2, "too many ids");
+
+    if ((out = fopen(argv[2], "wb")) == NULL)
+	unix_error(argv[2]);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("fwrite failed in main");
+
+    /* Line numbers match LINENUM in mdriver: request i is on line i+5 */
+    while (fscanf(in, "%63s", type) == 1) {
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%lu %lu", &index, &size) != 2)
+		bad_trace(argv[1], op_index + 5, "bad request");
+	    op.type = type[0] == 'a' ? ALLOC : REALLOC;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%lu", &index) != 1)
+		bad_trace(argv[1], op_index + 5, "bad request");
+	    op.type = FREE;
+	    break;
+	default:
+	    bad_trace(argv[1], op_index + 5, "bogus type character");
+	}
+	if (index >= hdr.num_ids)
+	    bad_trace(argv[1], op_index + 5, "id out of range");
+	if (size > 0xffffffffUL)
+	    bad_trace(argv[1], op_index + 5, "size does not fit in 32 bits");
+	if (op_index == hdr.num_ops)
+	    bad_trace(argv[1], op_index + 5, "more requests than the header says");
+	op.index = index;
+	op.size = size;
+	if (fwrite(&op, sizeof(op), 1, out) != 1)
+	    unix_error("fwrite failed in main");
+	op_index++;
+    }
+    if (op_index != hdr.num_ops)
+	bad_trace(argv[1], op_index + 5, "fewer requests than the header says");
+
+    fclose(in);
+    if (fclose(out) != 0)
+	unix_error(argv[2]);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * trace.h - requests of a trace, and the binary trace format
+ *
+ * A binary trace holds the same header and requests as a text trace,
+ * laid out so mdriver can map the file and replay the requests in
+ * place. It starts with a trace_header_t, followed by num_ops
+ * traceop_t records in the byte order of the machine that wrote it.
+ * Use rep2bin to convert a text trace. Request i of a binary trace
+ * is on line i+5 of the text trace it was converted from.
+ */
+#include <stdint.h>
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC};
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint32_t type : 2;                /* type of request */
+    uint32_t index : 30;              /* index for free() to use later */
+    uint32_t size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* First bytes of a binary trace */
+#define TRACE_MAGIC "MMTRACE1"
+
+/* Header of a binary trace */
+typedef struct {
+    char magic[8];           /* TRACE_MAGIC */
+    uint32_t sugg_heapsize;  /* suggested heap size (unused) */
+    uint32_t num_ids;        /* number of alloc/realloc ids */
+    uint32_t num_ops;        /* number of requests that follow */
+    uint32_t weight;         /* weight for this trace (unused) */
+} trace_header_t;